@@ -0,0 +1,28 @@
+// Report statistics of the headers of the region files of a directory in parallel without decompressing chunks
+#include "lmca.hpp"
+#include <iostream>
+using namespace std;
+int main(int argc, char *argv[])
+{
+    if (argc <= 1)
+    {
+        cout << "Please pass a region directory or a region file (and optionally \"-p\" to read the prefixes of chunks, and the number of threads) as arguments" << endl;
+        return 0;
+    }
+    bool prefixes = argc > 2 && argv[2] == string("-p");
+    size_t threads = argc > 2 + prefixes ? stoul(argv[2 + prefixes]) : thread::hardware_concurrency();
+    vector<filesystem::path> files;
+    if (filesystem::is_directory(argv[1]))
+    {
+        for (const auto &entry : filesystem::directory_iterator(argv[1]))
+            if (entry.path().extension() == ".mca")
+                files.push_back(entry.path());
+    }
+    else
+        files.push_back(argv[1]);
+    auto begin = chrono::steady_clock::now();
+    mca::RegionStats stats = mca::scanRegions(files, prefixes, threads);
+    stats.report(cout);
+    cout << "time: " << chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count() << " ms" << endl;
+    return 0;
+}
@@ -0,0 +1,51 @@
+// Infer the schema of the chunks in the region files of a directory in parallel
+#include "lmca.hpp"
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+using namespace std;
+int main(int argc, char *argv[])
+{
+    if (argc <= 1)
+    {
+        cout << "Please pass the region directory (and optionally the file to write the schema to) as arguments" << endl;
+        return 0;
+    }
+    vector<filesystem::path> files;
+    for (const auto &entry : filesystem::directory_iterator(argv[1]))
+        if (entry.path().extension() == ".mca")
+            files.push_back(entry.path());
+    atomic<size_t> next = 0;
+    mutex mutex;
+    nbt::schema::Inference inference;
+    vector<jthread> threads;
+    for (unsigned i = 0; i < max(thread::hardware_concurrency(), 1U); i++)
+        threads.emplace_back([&] {
+            nbt::schema::Inference partial;
+            for (size_t i = next++; i < files.size(); i = next++)
+            {
+                try
+                {
+                    for (const auto &chunk : mca::readRegion(ifstream(files[i], ios::binary)))
+                        if (chunk.has_value())
+                            partial.add(chunk->data.tag);
+                }
+                catch (const exception &e)
+                {
+                    lock_guard lock(mutex);
+                    cerr << files[i] << ": " << e.what() << endl;
+                }
+            }
+            lock_guard lock(mutex);
+            inference.merge(move(partial));
+        });
+    threads.clear();
+    cout << inference.documents << " chunks in " << files.size() << " region files" << endl;
+    inference.report(cout);
+    if (argc > 2)
+        nbt::str::stdWriter.write(ofstream(argv[2]), nbt::schema::toTag(inference.toSchema()));
+    return 0;
+}
@@ -0,0 +1,15 @@
+// Generate a header for reading and writing the documents of a schema directly
+#include "lnbt.hpp"
+#include <fstream>
+#include <iostream>
+using namespace std;
+int main(int argc, char *argv[])
+{
+    if (argc <= 3)
+    {
+        cout << "Please pass the schema (SNBT), the header to generate and the name of the root struct as arguments" << endl;
+        return 0;
+    }
+    nbt::schema::generate(ofstream(argv[2]), nbt::schema::read(ifstream(argv[1])), argv[3]);
+    return 0;
+}
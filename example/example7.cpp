@@ -0,0 +1,38 @@
+// Export columns of the chunks in the region files of a directory to CSV or a columnar file
+#include "lmca.hpp"
+#include <fstream>
+#include <iostream>
+using namespace std;
+int main(int argc, char *argv[])
+{
+    if (argc <= 3)
+    {
+        cout << "Please pass the region directory, the output file (*.csv for CSV) and the columns like `name=path:long`, `name=path:double` or `name=path:string` as arguments" << endl;
+        return 0;
+    }
+    vector<nbt::columnar::Column> columns;
+    for (int i = 3; i < argc; i++)
+    {
+        string_view arg = argv[i];
+        size_t eq = arg.find('='), colon = arg.rfind(':');
+        if (eq == string_view::npos || colon == string_view::npos || colon < eq)
+        {
+            cout << "Invalid column: " << arg << endl;
+            return 0;
+        }
+        string_view type = arg.substr(colon + 1);
+        columns.push_back({string(arg.substr(0, eq)), string(arg.substr(eq + 1, colon - eq - 1)),
+                           type == "double" ? nbt::columnar::Type::Double : type == "string" ? nbt::columnar::Type::String : nbt::columnar::Type::Long});
+    }
+    vector<filesystem::path> files;
+    for (const auto &entry : filesystem::directory_iterator(argv[1]))
+        if (entry.path().extension() == ".mca")
+            files.push_back(entry.path());
+    ofstream out(argv[2], ios::binary);
+    nbt::columnar::CsvSink csv(out);
+    nbt::columnar::FileSink file(out);
+    nbt::columnar::Sink &sink = filesystem::path(argv[2]).extension() == ".csv" ? static_cast<nbt::columnar::Sink &>(csv) : file;
+    nbt::columnar::Exporter exporter(columns, sink);
+    mca::exportRegions(files, exporter);
+    return 0;
+}
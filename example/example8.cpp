@@ -0,0 +1,40 @@
+// Train a zstd dictionary from a sample of the chunks in the region files of a directory
+#define LMCA_ZSTD
+#include "lmca.hpp"
+#include <iostream>
+using namespace std;
+int main(int argc, char *argv[])
+{
+    if (argc <= 2)
+    {
+        cout << "Please pass the region directory, the file to write the dictionary to (and optionally the maximum number of sampled chunks and the size of the dictionary) as arguments" << endl;
+        return 0;
+    }
+    size_t max_samples = argc > 3 ? stoul(argv[3]) : 4096, size = argc > 4 ? stoul(argv[4]) : 112640;
+    vector<filesystem::path> files;
+    for (const auto &entry : filesystem::directory_iterator(argv[1]))
+        if (entry.path().extension() == ".mca")
+            files.push_back(entry.path());
+    // take chunks from every region file evenly
+    vector<string> samples;
+    size_t per_file = max<size_t>(max_samples / max<size_t>(files.size(), 1), 1);
+    for (const auto &path : files)
+    {
+        try
+        {
+            mca::RegionFile file(path);
+            size_t count = 0;
+            for (size_t i = 0; i < 1024 && count < per_file && samples.size() < max_samples; i++)
+                if (file.getHeader()[i].exists())
+                    samples.push_back(mca::decompress(file.getPayload(i))), count++;
+        }
+        catch (const exception &e)
+        {
+            cerr << path << ": " << e.what() << endl;
+        }
+    }
+    mca::ZstdDictionary dict = mca::ZstdDictionary::train(samples, size);
+    dict.write(argv[2]);
+    cout << "Trained a dictionary of " << dict.getContent().size() << " bytes with ID " << dict.getID() << " from " << samples.size() << " chunks" << endl;
+    return 0;
+}
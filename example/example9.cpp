@@ -0,0 +1,46 @@
+// Compact a region file or the region files of a directory in parallel
+#include "lmca.hpp"
+#include <iostream>
+using namespace std;
+int main(int argc, char *argv[])
+{
+    if (argc <= 1)
+    {
+        cout << "Please pass a region file or a region directory (and optionally the number of threads) as arguments" << endl;
+        return 0;
+    }
+    vector<filesystem::path> files;
+    if (filesystem::is_directory(argv[1]))
+    {
+        for (const auto &entry : filesystem::directory_iterator(argv[1]))
+            if (entry.path().extension() == ".mca")
+                files.push_back(entry.path());
+    }
+    else
+        files.push_back(argv[1]);
+    vector<mca::Compaction> results = mca::compactRegions(files, argc > 2 ? stoul(argv[2]) : thread::hardware_concurrency());
+    size_t before = 0, after = 0;
+    size_t failed = 0;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        if (results[i].error)
+        {
+            try
+            {
+                rethrow_exception(results[i].error);
+            }
+            catch (const exception &e)
+            {
+                cout << files[i].filename().string() << ": " << e.what() << endl;
+            }
+            failed++;
+            continue;
+        }
+        cout << files[i].filename().string() << ": " << results[i].before << " -> " << results[i].after << " bytes" << endl;
+        before += results[i].before, after += results[i].after;
+    }
+    cout << "Compacted " << files.size() - failed << " region files from " << before << " to " << after << " bytes" << endl;
+    if (failed != 0)
+        cout << "Failed to compact " << failed << " region files" << endl;
+    return failed == 0 ? 0 : 1;
+}
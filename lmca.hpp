@@ -22,7 +22,35 @@
 #include "include/zstr.hpp"
 #include "lnbt.hpp"
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <memory>
 #include <optional>
+#include <shared_mutex>
+#include <spanstream>
+#include <stop_token>
+#include <thread>
+#ifdef LMCA_LZ4
+#include <lz4.h>
+#endif
+#if __has_include(<linux/io_uring.h>) && __has_include(<sys/syscall.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#ifdef LMCA_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
 
 namespace mca
 {
@@ -71,36 +99,655 @@ SectorInfo getLocation(uint32_t location)
     return {endian::native == endian::little ? byteswap(location) >> 8 : location << 8,
             reinterpret_cast<uint8_t *>(&location)[3]};
 }
-/// Read the data of a chunk from a region file
-NBT readChunk(istream &region, SectorInfo location)
+/// Encode the location of a chunk in the header of a region file
+inline uint32_t makeLocation(SectorInfo location)
+{
+    return endianswap(location.offset << 8 | location.count);
+}
+/// The entry of a chunk in the header of a region file
+struct HeaderEntry
+{
+    SectorInfo location;
+    uint32_t timestamp;
+    /// Whether the chunk exists in the region file
+    bool exists() const
+    {
+        return location.offset >= 2 && location.count > 0;
+    }
+};
+/// The compression type and the compressed data of a chunk
+struct Payload
+{
+    uint8_t compression_type;
+    span<const char> data;
+};
+/// The name of the algorithm of compression type 127 (custom compression) implemented by zstd, which follows the type as a string with a big-endian 16-bit length
+constexpr string_view zstd_algorithm = "lnbt:zstd";
+class ZstdDictionary;
+#ifdef LMCA_ZSTD
+/// A zstd dictionary for compressing chunks, which is identified by the ID stored in it and in the frames compressed with it
+/// Chunks are repetitive across a world, so a dictionary trained from a sample of its chunks improves both the ratio and the speed
+class ZstdDictionary
+{
+    string dict;
+    int level;
+    shared_ptr<ZSTD_CDict> cdict;
+    shared_ptr<ZSTD_DDict> ddict;
+public:
+    /// Load a dictionary from its content for compressing at a level
+    explicit ZstdDictionary(string content, int level = ZSTD_CLEVEL_DEFAULT) : dict(::std::move(content)), level(level)
+    {
+        cdict.reset(ZSTD_createCDict(dict.data(), dict.size(), level), ZSTD_freeCDict);
+        ddict.reset(ZSTD_createDDict(dict.data(), dict.size()), ZSTD_freeDDict);
+        if (!cdict || !ddict)
+            throw runtime_error("invalid zstd dictionary");
+    }
+    /// Train a dictionary from samples, such as the uncompressed data of some chunks of a world
+    static ZstdDictionary train(const vector<string> &samples, size_t capacity = 112640, int level = ZSTD_CLEVEL_DEFAULT)
+    {
+        string buffer;
+        vector<size_t> sizes;
+        for (const auto &sample : samples)
+            buffer += sample, sizes.push_back(sample.size());
+        string content(capacity, '\0');
+        size_t size = ZDICT_trainFromBuffer(content.data(), capacity, buffer.data(), sizes.data(), sizes.size());
+        if (ZDICT_isError(size))
+            throw runtime_error(string("ZDICT_trainFromBuffer() error: ") + ZDICT_getErrorName(size));
+        content.resize(size);
+        return ZstdDictionary(::std::move(content), level);
+    }
+    /// Read a dictionary from a file, such as one stored alongside a world
+    static ZstdDictionary read(const filesystem::path &path, int level = ZSTD_CLEVEL_DEFAULT)
+    {
+        ifstream in(path, ios::binary);
+        in.exceptions(istream::failbit | istream::badbit);
+        return ZstdDictionary(string(istreambuf_iterator<char>(in), {}), level);
+    }
+    /// Write the dictionary to a file
+    void write(const filesystem::path &path) const
+    {
+        ofstream out(path, ios::binary);
+        out.exceptions(ostream::failbit | ostream::badbit);
+        out.write(dict.data(), dict.size());
+    }
+    unsigned getID() const
+    {
+        return ZDICT_getDictID(dict.data(), dict.size());
+    }
+    const string &getContent() const
+    {
+        return dict;
+    }
+    int getLevel() const
+    {
+        return level;
+    }
+    const ZSTD_CDict *getCDict() const
+    {
+        return cdict.get();
+    }
+    const ZSTD_DDict *getDDict() const
+    {
+        return ddict.get();
+    }
+};
+namespace detail
+{
+/// The dictionaries for decompressing chunks by their IDs
+struct Dictionaries
+{
+    shared_mutex mutex;
+    map<unsigned, shared_ptr<const ZstdDictionary>> dicts;
+};
+inline Dictionaries &dictionaries()
+{
+    static Dictionaries dictionaries;
+    return dictionaries;
+}
+} // namespace detail
+/// Register a dictionary for decompressing the chunks compressed with it, which are matched by the ID in their frames
+inline void registerDictionary(ZstdDictionary dict)
+{
+    detail::Dictionaries &dictionaries = detail::dictionaries();
+    unique_lock lock(dictionaries.mutex);
+    unsigned id = dict.getID();
+    dictionaries.dicts[id] = make_shared<const ZstdDictionary>(::std::move(dict));
+}
+#endif
+namespace detail
+{
+/// A growable buffer which keeps its memory across chunks and doesn't initialize it
+class Buffer
+{
+    unique_ptr<char[]> ptr;
+    size_t cap = 0;
+public:
+    size_t size = 0;
+    char *data() const
+    {
+        return ptr.get();
+    }
+    size_t capacity() const
+    {
+        return cap;
+    }
+    /// Ensure the capacity, keeping the first `size` bytes
+    void reserve(size_t n)
+    {
+        if (n <= cap)
+            return;
+        n = max(n, 2 * cap);
+        unique_ptr<char[]> p(new char[n]);
+        if (size != 0)
+            memcpy(p.get(), ptr.get(), size);
+        ptr = ::std::move(p), cap = n;
+    }
+};
+/// The buffers of a thread for the compressed and the decompressed data of a chunk
+/// The decompression buffer keeps the size of the largest chunk so far, which is usually enough for the next one
+struct Buffers
+{
+    Buffer compressed, data;
+};
+inline Buffers &buffers()
+{
+    thread_local Buffers buffers;
+    return buffers;
+}
+/// A zlib decompressor reused by a thread across chunks through `inflateReset`
+class Inflater
+{
+    z_stream zs{};
+public:
+    Inflater()
+    {
+        if (inflateInit2(&zs, 15 + 32) != Z_OK) // detect the header automatically
+            throw runtime_error("inflateInit2() error");
+    }
+    Inflater(const Inflater &) = delete;
+    Inflater &operator=(const Inflater &) = delete;
+    ~Inflater()
+    {
+        inflateEnd(&zs);
+    }
+    /// Decompress zlib or gzip data of exactly `size` bytes into a buffer
+    void inflate(const char *data, size_t size, Buffer &out)
+    {
+        NBT_TRACE_SPAN("inflate");
+        if (inflateReset(&zs) != Z_OK)
+            throw runtime_error("inflateReset() error");
+        zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        zs.avail_in = size;
+        out.size = 0;
+        out.reserve(4 * size);
+        for (;;)
+        {
+            if (out.size == out.capacity())
+                out.reserve(2 * out.capacity());
+            zs.next_out = reinterpret_cast<Bytef *>(out.data() + out.size);
+            zs.avail_out = out.capacity() - out.size;
+            int ret = ::inflate(&zs, Z_NO_FLUSH);
+            out.size = out.capacity() - zs.avail_out;
+            if (ret == Z_STREAM_END)
+                return;
+            if (ret != Z_OK && (ret != Z_BUF_ERROR || zs.avail_in == 0))
+                throw runtime_error("invalid compressed data");
+        }
+    }
+};
+inline Inflater &inflater()
+{
+    thread_local Inflater inflater;
+    return inflater;
+}
+/// A zlib compressor reused by a thread across chunks through `deflateReset`
+class Deflater
+{
+    z_stream zs{};
+public:
+    /// Compress zlib data, or gzip data with `window_bits` of 15 + 16
+    explicit Deflater(int window_bits, int level = Z_DEFAULT_COMPRESSION)
+    {
+        if (deflateInit2(&zs, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            throw runtime_error("deflateInit2() error");
+    }
+    Deflater(const Deflater &) = delete;
+    Deflater &operator=(const Deflater &) = delete;
+    ~Deflater()
+    {
+        deflateEnd(&zs);
+    }
+    /// Compress data into a buffer in a single call, whose capacity is ensured by `deflateBound`
+    void deflate(const char *data, size_t size, Buffer &out)
+    {
+        if (deflateReset(&zs) != Z_OK)
+            throw runtime_error("deflateReset() error");
+        out.size = 0;
+        out.reserve(deflateBound(&zs, size));
+        zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        zs.avail_in = size;
+        zs.next_out = reinterpret_cast<Bytef *>(out.data());
+        zs.avail_out = out.capacity();
+        if (::deflate(&zs, Z_FINISH) != Z_STREAM_END)
+            throw runtime_error("deflate() error");
+        out.size = zs.total_out;
+    }
+};
+inline Deflater &deflater(bool gzip)
+{
+    thread_local Deflater zlib(15), gz(15 + 16);
+    return gzip ? gz : zlib;
+}
+/// An output stream buffer writing directly into a buffer, so that NBT is serialized into contiguous memory
+class BufferWriter : public streambuf
+{
+    Buffer &buffer;
+public:
+    explicit BufferWriter(Buffer &buffer) : buffer(buffer)
+    {
+        buffer.size = 0;
+        buffer.reserve(0x1000);
+        setp(buffer.data(), buffer.data() + buffer.capacity());
+    }
+    /// Set the size of the buffer to the bytes written
+    void finish()
+    {
+        buffer.size = pptr() - pbase();
+    }
+protected:
+    int_type overflow(int_type ch) override
+    {
+        size_t size = pptr() - pbase();
+        buffer.size = size;
+        buffer.reserve(2 * buffer.capacity());
+        setp(buffer.data(), buffer.data() + buffer.capacity());
+        pbump(static_cast<int>(size));
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+};
+/// Serialize NBT into a buffer
+inline span<const char> serialize(const NBT &data, Buffer &out)
+{
+    BufferWriter writer(out);
+    ostream stream(&writer);
+    bin::write(stream, data);
+    writer.finish();
+    return span(out.data(), out.size);
+}
+/// Check the length of a chunk against the bytes available in its sectors, which include the 4-byte length itself
+inline void checkLength(uint32_t length, size_t available)
+{
+    if (length == 0 || available < 5 || length > available - 4)
+        throw runtime_error("invalid chunk length");
+}
+/// Read the payload of a chunk into a buffer
+inline Payload readPayload(istream &region, SectorInfo location, Buffer &buffer)
 {
+    NBT_TRACE_SPAN("read sector");
     region.seekg(0x1000 * location.offset);
     uint32_t length;
     region.read(reinterpret_cast<char *>(&length), 4);
     length = endianswap(length);
+    checkLength(length, 0x1000 * size_t(location.count));
     uint8_t compression_type = region.get();
+    buffer.size = 0;
+    buffer.reserve(length - 1);
+    region.read(buffer.data(), length - 1);
+    buffer.size = length - 1;
+    return {compression_type, span(buffer.data(), buffer.size)};
+}
+/// Read the payload of a chunk into the compression buffer of the current thread, which is valid until the next call
+inline Payload readPayload(istream &region, SectorInfo location)
+{
+    return readPayload(region, location, buffers().compressed);
+}
+/// Hash data by XXH32, which is used for the checksums of LZ4 blocks
+inline uint32_t xxhash32(const char *data, size_t size, uint32_t seed)
+{
+    constexpr uint32_t prime1 = 2654435761U, prime2 = 2246822519U, prime3 = 3266489917U, prime4 = 668265263U, prime5 = 374761393U;
+    auto read = [](const char *p) {
+        uint32_t val;
+        memcpy(&val, p, 4);
+        return endianswap<endian::little>(val);
+    };
+    auto round = [](uint32_t acc, uint32_t input) { return rotl(acc + input * prime2, 13) * prime1; };
+    const char *p = data, *end = data + size;
+    uint32_t hash;
+    if (size >= 16)
+    {
+        uint32_t v1 = seed + prime1 + prime2, v2 = seed + prime2, v3 = seed, v4 = seed - prime1;
+        for (; p + 16 <= end; p += 16)
+            v1 = round(v1, read(p)), v2 = round(v2, read(p + 4)), v3 = round(v3, read(p + 8)), v4 = round(v4, read(p + 12));
+        hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    }
+    else
+        hash = seed + prime5;
+    hash += static_cast<uint32_t>(size);
+    for (; p + 4 <= end; p += 4)
+        hash = rotl(hash + read(p) * prime3, 17) * prime4;
+    for (; p < end; p++)
+        hash = rotl(hash + static_cast<uint8_t>(*p) * prime5, 11) * prime1;
+    hash = (hash ^ hash >> 15) * prime2;
+    hash = (hash ^ hash >> 13) * prime3;
+    return hash ^ hash >> 16;
+}
+/// The block stream format of lz4-java (`LZ4BlockOutputStream`), which is used by compression type 4
+/// Each block has a header of the magic, a token of the method and the level, the compressed and the original length and a checksum, all in little endian
+namespace lz4block
+{
+constexpr char magic[] = "LZ4Block";
+constexpr size_t magic_size = 8, header_size = 21;
+constexpr uint8_t method_raw = 0x10, method_lz4 = 0x20;
+constexpr uint32_t seed = 0x9747B28C;
+/// The block size of `LZ4BlockOutputStream` by default, whose level is log2(size) - 10
+constexpr size_t block_size = 1 << 16, level = 6;
+/// Only the low 28 bits of the hashes are stored
+inline uint32_t checksum(const char *data, size_t size)
+{
+    return xxhash32(data, size, seed) & 0xFFFFFFF;
+}
+} // namespace lz4block
+#ifdef LMCA_LZ4
+/// Decompress an LZ4 block stream into a buffer
+inline void inflateLZ4(const char *data, size_t size, Buffer &out)
+{
+    NBT_TRACE_SPAN("inflate");
+    using namespace lz4block;
+    auto read = [](const char *p) {
+        uint32_t val;
+        memcpy(&val, p, 4);
+        return endianswap<endian::little>(val);
+    };
+    out.size = 0;
+    for (const char *p = data, *end = data + size; p != end;)
+    {
+        if (end - p < ptrdiff_t(header_size) || memcmp(p, magic, magic_size) != 0)
+            throw runtime_error("invalid LZ4 block");
+        uint8_t method = p[magic_size] & 0xF0, block_level = p[magic_size] & 0x0F;
+        uint32_t compressed = read(p + magic_size + 1), original = read(p + magic_size + 5), check = read(p + magic_size + 9);
+        p += header_size;
+        if (original > size_t(1) << (block_level + 10) || compressed > size_t(end - p) || (method != method_raw && method != method_lz4))
+            throw runtime_error("invalid LZ4 block");
+        if (original == 0) // the end mark
+        {
+            if (compressed != 0 || check != 0)
+                throw runtime_error("invalid LZ4 block");
+            break;
+        }
+        out.reserve(out.size + original);
+        char *dst = out.data() + out.size;
+        if (method == method_raw)
+        {
+            if (compressed != original)
+                throw runtime_error("invalid LZ4 block");
+            memcpy(dst, p, original);
+        }
+        else if (LZ4_decompress_safe(p, dst, compressed, original) != int(original))
+            throw runtime_error("invalid LZ4 block");
+        if (checksum(dst, original) != check)
+            throw runtime_error("LZ4 checksum mismatch");
+        out.size += original;
+        p += compressed;
+    }
+}
+/// Compress data into an LZ4 block stream, which ends with an end mark like `LZ4BlockOutputStream`
+inline void deflateLZ4(const char *data, size_t size, Buffer &out)
+{
+    using namespace lz4block;
+    auto write = [](char *p, uint32_t val) {
+        val = endianswap<endian::little>(val);
+        memcpy(p, &val, 4);
+    };
+    auto writeHeader = [&write](char *p, uint8_t method, uint32_t compressed, uint32_t original, uint32_t check) {
+        memcpy(p, magic, magic_size);
+        p[magic_size] = static_cast<char>(method | level);
+        write(p + magic_size + 1, compressed), write(p + magic_size + 5, original), write(p + magic_size + 9, check);
+    };
+    out.size = 0;
+    for (size_t offset = 0; offset < size; offset += block_size)
+    {
+        size_t original = min(block_size, size - offset);
+        const char *src = data + offset;
+        out.reserve(out.size + header_size + LZ4_compressBound(original));
+        char *dst = out.data() + out.size;
+        int compressed = LZ4_compress_default(src, dst + header_size, original, LZ4_compressBound(original));
+        if (compressed <= 0 || size_t(compressed) >= original) // store raw blocks that don't shrink
+        {
+            memcpy(dst + header_size, src, original);
+            writeHeader(dst, method_raw, original, original, checksum(src, original));
+            out.size += header_size + original;
+        }
+        else
+        {
+            writeHeader(dst, method_lz4, compressed, original, checksum(src, original));
+            out.size += header_size + compressed;
+        }
+    }
+    out.reserve(out.size + header_size);
+    writeHeader(out.data() + out.size, method_raw, 0, 0, 0);
+    out.size += header_size;
+}
+#endif
+#ifdef LMCA_ZSTD
+/// The zstd contexts reused by a thread across chunks
+struct ZstdContexts
+{
+    unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx *)> cctx{ZSTD_createCCtx(), ZSTD_freeCCtx};
+    unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx *)> dctx{ZSTD_createDCtx(), ZSTD_freeDCtx};
+};
+inline ZstdContexts &zstdContexts()
+{
+    thread_local ZstdContexts contexts;
+    return contexts;
+}
+/// The maximum content size a zstd frame of a chunk may claim
+inline constexpr unsigned long long max_zstd_content = 1ULL << 31;
+/// Decompress a zstd frame into a buffer, with the registered dictionary whose ID is in the frame if any
+inline void inflateZstd(const char *data, size_t size, Buffer &out)
+{
+    NBT_TRACE_SPAN("inflate");
+    ZSTD_DCtx *dctx = zstdContexts().dctx.get();
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_and_parameters);
+    shared_ptr<const ZstdDictionary> dict;
+    if (unsigned id = ZSTD_getDictID_fromFrame(data, size); id != 0)
+    {
+        Dictionaries &dictionaries = detail::dictionaries();
+        shared_lock lock(dictionaries.mutex);
+        auto i = dictionaries.dicts.find(id);
+        if (i == dictionaries.dicts.end())
+            throw runtime_error("the zstd dictionary " + to_string(id) + " is not registered");
+        dict = i->second;
+        ZSTD_DCtx_refDDict(dctx, dict->getDDict());
+    }
+    // The content size comes from the frame header of an untrusted chunk, so it only bounds the initial reservation and the buffer grows from there
+    unsigned long long content_size = ZSTD_getFrameContentSize(data, size);
+    if (content_size < ZSTD_CONTENTSIZE_ERROR && content_size > max_zstd_content)
+        throw runtime_error("invalid chunk");
+    out.size = 0;
+    out.reserve(content_size < ZSTD_CONTENTSIZE_ERROR ? min<size_t>(content_size + 1, 16 * size + 0x1000) : 4 * size);
+    ZSTD_inBuffer in{data, size, 0};
+    for (;;)
+    {
+        if (out.size == out.capacity())
+            out.reserve(2 * out.capacity());
+        ZSTD_outBuffer output{out.data(), out.capacity(), out.size};
+        size_t ret = ZSTD_decompressStream(dctx, &output, &in);
+        out.size = output.pos;
+        if (ZSTD_isError(ret))
+            throw runtime_error(string("invalid zstd data: ") + ZSTD_getErrorName(ret));
+        if (ret == 0)
+            return;
+        if (in.pos == in.size && output.pos < output.size)
+            throw runtime_error("truncated zstd data");
+    }
+}
+/// Compress data into a zstd frame with a dictionary if any, appending it to a buffer
+inline void deflateZstd(const char *data, size_t size, Buffer &out, const ZstdDictionary *dict = nullptr, int level = ZSTD_CLEVEL_DEFAULT)
+{
+    ZSTD_CCtx *cctx = zstdContexts().cctx.get();
+    ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+    if (dict != nullptr)
+        ZSTD_CCtx_refCDict(cctx, dict->getCDict());
+    else
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+    size_t bound = ZSTD_compressBound(size);
+    out.reserve(out.size + bound);
+    size_t ret = ZSTD_compress2(cctx, out.data() + out.size, bound, data, size);
+    if (ZSTD_isError(ret))
+        throw runtime_error(string("ZSTD_compress2() error: ") + ZSTD_getErrorName(ret));
+    out.size += ret;
+}
+#endif
+/// Decompress a payload of compression type 127 by the algorithm named at its beginning
+inline void inflateCustom(const char *data, size_t size, [[maybe_unused]] Buffer &out)
+{
+    if (size < 2)
+        throw runtime_error("invalid custom compression");
+    size_t length = static_cast<uint8_t>(data[0]) << 8 | static_cast<uint8_t>(data[1]);
+    if (size < 2 + length)
+        throw runtime_error("invalid custom compression");
+    string_view algorithm(data + 2, length);
+    if (algorithm == zstd_algorithm)
+    {
+#ifdef LMCA_ZSTD
+        inflateZstd(data + 2 + length, size - 2 - length, out);
+        return;
+#else
+        throw runtime_error("zstd requires LMCA_ZSTD to be defined and libzstd");
+#endif
+    }
+    throw runtime_error("unsupported custom compression algorithm " + string(algorithm));
+}
+#ifdef LMCA_ZSTD
+/// Compress data into a payload of compression type 127 by zstd with a dictionary if any
+inline void deflateCustom(const char *data, size_t size, Buffer &out, const ZstdDictionary *dict = nullptr, int level = ZSTD_CLEVEL_DEFAULT)
+{
+    out.size = 0;
+    out.reserve(2 + zstd_algorithm.size());
+    out.data()[0] = static_cast<char>(zstd_algorithm.size() >> 8), out.data()[1] = static_cast<char>(zstd_algorithm.size());
+    memcpy(out.data() + 2, zstd_algorithm.data(), zstd_algorithm.size());
+    out.size = 2 + zstd_algorithm.size();
+    deflateZstd(data, size, out, dict, level);
+}
+#endif
+/// Decompress the payload of a chunk into a buffer
+inline void decompress(uint8_t compression_type, span<const char> payload, Buffer &out)
+{
     switch (compression_type)
     {
     case 1: // GZip (RFC1952)
     case 2: // Zlib (RFC1950)
-        return bin::read(zstr::istream(region));
+        inflater().inflate(payload.data(), payload.size(), out);
+        return;
     case 3: // Uncompressed
-        return bin::read(region);
-    case 4:   // LZ4
+        out.size = 0;
+        out.reserve(payload.size());
+        memcpy(out.data(), payload.data(), payload.size());
+        out.size = payload.size();
+        return;
+    case 4: // LZ4
+#ifdef LMCA_LZ4
+        inflateLZ4(payload.data(), payload.size(), out);
+        return;
+#else
+        throw runtime_error("LZ4 requires LMCA_LZ4 to be defined and liblz4");
+#endif
     case 127: // Custom compression algorithm
+        inflateCustom(payload.data(), payload.size(), out);
+        return;
     default:
         throw runtime_error("unknown compression schemes");
     }
 }
-NBT readChunk(istream &&region, SectorInfo location)
+/// Decompress the payload of a chunk, which refers to either the payload itself or the decompression buffer of the current thread
+inline span<const char> decompress(uint8_t compression_type, span<const char> payload)
 {
-    return readChunk(region, location);
+    if (compression_type == 3) // Uncompressed
+        return payload;
+    Buffer &data = buffers().data;
+    decompress(compression_type, payload, data);
+    return span(data.data(), data.size);
 }
-/// Read a chunk from a region file
-Chunk readChunk(istream &region, size_t x, size_t z)
+/// Compress the data of a chunk, which refers to either the data itself or the compression buffer of the current thread
+/// The dictionary, if any, is used by compression type 127
+inline span<const char> compress(uint8_t compression_type, span<const char> data, [[maybe_unused]] const ZstdDictionary *dict = nullptr)
 {
-    region.exceptions(istream::eofbit | istream::failbit | istream::badbit);
-
+    Buffer &out = buffers().compressed;
+    switch (compression_type)
+    {
+    case 1: // GZip (RFC1952)
+    case 2: // Zlib (RFC1950)
+        deflater(compression_type == 1).deflate(data.data(), data.size(), out);
+        return span(out.data(), out.size);
+    case 3: // Uncompressed
+        return data;
+    case 4: // LZ4
+#ifdef LMCA_LZ4
+        deflateLZ4(data.data(), data.size(), out);
+        return span(out.data(), out.size);
+#else
+        throw runtime_error("LZ4 requires LMCA_LZ4 to be defined and liblz4");
+#endif
+    case 127: // Custom compression algorithm
+#ifdef LMCA_ZSTD
+        deflateCustom(data.data(), data.size(), out, dict);
+        return span(out.data(), out.size);
+#else
+        throw runtime_error("zstd requires LMCA_ZSTD to be defined and libzstd");
+#endif
+    default:
+        throw runtime_error("unknown compression schemes");
+    }
+}
+/// Serialize and compress the data of a chunk with the buffers of the current thread
+inline span<const char> encode(const NBT &data, uint8_t compression_type, const ZstdDictionary *dict = nullptr)
+{
+    return compress(compression_type, serialize(data, buffers().data), dict);
+}
+/// The current time as the timestamp of a chunk
+inline uint32_t now()
+{
+    return static_cast<uint32_t>(chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count());
+}
+/// The number of sectors of a chunk with a payload of a size
+inline uint8_t sectorCount(size_t size)
+{
+    size_t count = (5 + size + 0xFFF) / 0x1000;
+    if (count > 0xFF)
+        throw runtime_error("the chunk is too large for a region file");
+    return static_cast<uint8_t>(count);
+}
+/// Write the length and the compression type preceding the payload of a chunk
+inline void writeChunkHeader(char *out, uint8_t compression_type, size_t size)
+{
+    uint32_t length = endianswap(static_cast<uint32_t>(size + 1));
+    memcpy(out, &length, 4);
+    out[4] = static_cast<char>(compression_type);
+}
+/// Decompress and parse the payload of a chunk
+inline NBT decode(uint8_t compression_type, span<const char> payload)
+{
+    return bin::read(ispanstream(decompress(compression_type, payload)));
+}
+/// Decompress and parse the payload of a chunk and update statistics
+inline NBT decode(uint8_t compression_type, span<const char> payload, bin::Stats &stats)
+{
+    auto begin = chrono::steady_clock::now();
+    span<const char> data = decompress(compression_type, payload);
+    if (compression_type != 3)
+        stats.inflate_time += chrono::steady_clock::now() - begin;
+    stats.addChunk(payload.size(), data.size());
+    return bin::read(ispanstream(data), stats);
+}
+/// Read the location and the timestamp of a chunk from the header of a region file
+inline pair<SectorInfo, uint32_t> locate(istream &region, size_t x, size_t z)
+{
+    NBT_TRACE_SPAN("read header");
     size_t offset = x + 32 * z;
 
     region.seekg(4 * offset);
@@ -113,35 +760,2390 @@ Chunk readChunk(istream &region, size_t x, size_t z)
         throw runtime_error("size has to be > 0");
 
     region.seekg(0x1000 + 4 * offset);
-    uint32_t timestamp = endianswap(getValue<uint32_t>(region));
+    return {location, endianswap(getValue<uint32_t>(region))};
+}
+/// The maximum bytes of the sectors of adjacent chunks read together by `readRegion`
+inline constexpr size_t max_run = 1 << 20;
+/// Read the chunks of a region file with a function decoding the payload of a chunk
+/// The chunks are visited in the order of their sectors rather than their indices, and the sectors of adjacent chunks are read in runs by single reads, so the file is read forward without seeking back
+template <typename Decode>
+Region readRegion(istream &region, Decode &&decode)
+{
+    region.exceptions(istream::eofbit | istream::failbit | istream::badbit);
 
+    uint32_t locations[1024], timestamps[1024];
+    {
+        NBT_TRACE_SPAN("read header");
+        region.read(reinterpret_cast<char *>(&locations), sizeof(locations));
+        region.read(reinterpret_cast<char *>(&timestamps), sizeof(timestamps));
+    }
+    vector<pair<SectorInfo, uint32_t>> chunks;
+    for (uint32_t i = 0; i < 1024; i++)
+        if (SectorInfo location = getLocation(locations[i]); location.offset >= 2 && location.count > 0)
+            chunks.emplace_back(location, i);
+    ranges::sort(chunks, {}, [](const auto &chunk) { return chunk.first.offset; });
+    region.seekg(0, ios::end);
+    size_t size = region.tellg();
+
+    Region ret;
+    Buffer &buffer = buffers().compressed;
+    for (size_t i = 0; i < chunks.size();)
+    {
+        size_t begin = 0x1000 * size_t(chunks[i].first.offset), end = begin + 0x1000 * size_t(chunks[i].first.count), j = i + 1;
+        for (; j < chunks.size() && 0x1000 * size_t(chunks[j].first.offset) == end && end - begin < max_run; j++)
+            end += 0x1000 * size_t(chunks[j].first.count);
+        // the last sectors may be short at the end of the file, which must still contain the whole payload
+        end = min(end, size);
+        if (begin + 5 > end)
+            throw runtime_error("sector is out of the region file");
+        {
+            NBT_TRACE_SPAN("read sectors");
+            region.seekg(begin);
+            buffer.size = 0;
+            buffer.reserve(end - begin);
+            region.read(buffer.data(), end - begin);
+        }
+        for (; i < j; i++)
+        {
+            auto [location, index] = chunks[i];
+            size_t offset = 0x1000 * size_t(location.offset) - begin;
+            uint32_t length = 0;
+            if (offset + 5 <= end - begin)
+                memcpy(&length, buffer.data() + offset, 4);
+            length = endianswap(length);
+            checkLength(length, min(0x1000 * size_t(location.count), end - begin - offset));
+            ret[index] = optional(Chunk{endianswap(timestamps[index]), decode(static_cast<uint8_t>(buffer.data()[offset + 4]), span<const char>(buffer.data() + offset + 5, length - 1))});
+        }
+    }
+    return ret;
+}
+} // namespace detail
+/// Decompress the payload of a chunk, such as for collecting the data of chunks to train a dictionary
+inline string decompress(const Payload &payload)
+{
+    span<const char> data = detail::decompress(payload.compression_type, payload.data);
+    return string(data.begin(), data.end());
+}
+/// Read the data of a chunk from a region file
+/// The payload is read into a buffer by its length and decompressed by a decompressor, both of which are reused by the current thread
+NBT readChunk(istream &region, SectorInfo location)
+{
+    Payload payload = detail::readPayload(region, location);
+    return detail::decode(payload.compression_type, payload.data);
+}
+NBT readChunk(istream &&region, SectorInfo location)
+{
+    return readChunk(region, location);
+}
+/// Read the data of a chunk from a region file and update statistics
+inline NBT readChunk(istream &region, SectorInfo location, bin::Stats &stats)
+{
+    Payload payload = detail::readPayload(region, location);
+    return detail::decode(payload.compression_type, payload.data, stats);
+}
+inline NBT readChunk(istream &&region, SectorInfo location, bin::Stats &stats)
+{
+    return readChunk(region, location, stats);
+}
+/// Read a chunk from a region file
+Chunk readChunk(istream &region, size_t x, size_t z)
+{
+    region.exceptions(istream::eofbit | istream::failbit | istream::badbit);
+    auto [location, timestamp] = detail::locate(region, x, z);
     return {timestamp, readChunk(region, location)};
 }
 Chunk readChunk(istream &&region, size_t x, size_t z)
 {
     return readChunk(region, x, z);
 }
+/// Read a chunk from a region file and update statistics
+inline Chunk readChunk(istream &region, size_t x, size_t z, bin::Stats &stats)
+{
+    region.exceptions(istream::eofbit | istream::failbit | istream::badbit);
+    auto [location, timestamp] = detail::locate(region, x, z);
+    return {timestamp, readChunk(region, location, stats)};
+}
+inline Chunk readChunk(istream &&region, size_t x, size_t z, bin::Stats &stats)
+{
+    return readChunk(region, x, z, stats);
+}
 /// Read a region from a region file
 Region readRegion(istream &region)
 {
-    region.exceptions(istream::eofbit | istream::failbit | istream::badbit);
-
+    return detail::readRegion(region, [](uint8_t compression_type, span<const char> payload) { return detail::decode(compression_type, payload); });
+}
+Region readRegion(istream &&region)
+{
+    return readRegion(region);
+}
+/// Read a region from a region file and update statistics
+inline Region readRegion(istream &region, bin::Stats &stats)
+{
+    return detail::readRegion(region, [&stats](uint8_t compression_type, span<const char> payload) { return detail::decode(compression_type, payload, stats); });
+}
+inline Region readRegion(istream &&region, bin::Stats &stats)
+{
+    return readRegion(region, stats);
+}
+/// Write a region to a region file, laying out its chunks consecutively after the header
+/// The chunks of compression type 127 are compressed with the dictionary if any, which should be registered for reading them
+inline void writeRegion(ostream &region, const Region &data, uint8_t compression_type = 2, const ZstdDictionary *dict = nullptr)
+{
+    region.exceptions(ostream::failbit | ostream::badbit);
+    uint32_t locations[1024]{}, timestamps[1024]{};
+    string sectors;
+    for (size_t i = 0; i < 1024; i++)
+    {
+        if (!data[i])
+            continue;
+        span<const char> payload = detail::encode(data[i]->data, compression_type, dict);
+        SectorInfo location{static_cast<uint32_t>(2 + sectors.size() / 0x1000), detail::sectorCount(payload.size())};
+        locations[i] = makeLocation(location);
+        timestamps[i] = endianswap(data[i]->timestamp);
+        size_t begin = sectors.size();
+        sectors.resize(begin + 0x1000 * location.count);
+        detail::writeChunkHeader(sectors.data() + begin, compression_type, payload.size());
+        memcpy(sectors.data() + begin + 5, payload.data(), payload.size());
+    }
+    region.write(reinterpret_cast<const char *>(&locations), sizeof(locations));
+    region.write(reinterpret_cast<const char *>(&timestamps), sizeof(timestamps));
+    region.write(sectors.data(), sectors.size());
+}
+inline void writeRegion(ostream &&region, const Region &data, uint8_t compression_type = 2, const ZstdDictionary *dict = nullptr)
+{
+    writeRegion(region, data, compression_type, dict);
+}
+/// A writer updating the chunks of a region file in place, which keeps the header and the uses of the sectors in memory
+/// A chunk is written to its current sectors if it fits and no other chunk overlaps them, or else to the first free sectors large enough, and only its sectors and its entries in the header are written
+class RegionWriter
+{
+    fstream file;
+    array<HeaderEntry, 1024> header{};
+    vector<uint16_t> uses; // the number of chunks (or the header) using each sector, which is more than 1 where the chunks of a damaged file overlap
+#ifdef LMCA_ZSTD
+    shared_ptr<const ZstdDictionary> dictionary;
+#endif
+    void mark(uint32_t offset, size_t count, int delta)
+    {
+        if (uses.size() < offset + count)
+            uses.resize(offset + count);
+        for (size_t k = offset; k < offset + count; k++)
+            uses[k] += delta;
+    }
+    /// Whether the sectors of a chunk are used by no other chunk, so it can be rewritten in place
+    bool exclusive(SectorInfo location) const
+    {
+        return all_of(uses.begin() + location.offset, uses.begin() + location.offset + location.count, [](uint16_t n) { return n == 1; });
+    }
+    /// Find the first free sectors large enough, which may extend the file
+    uint32_t allocate(size_t count)
+    {
+        size_t run = 0;
+        for (size_t i = 2; i < uses.size(); i++)
+        {
+            run = uses[i] != 0 ? 0 : run + 1;
+            if (run == count)
+                return static_cast<uint32_t>(i + 1 - count);
+        }
+        size_t offset = uses.size() - run;
+        if (offset + count > 0xFFFFFF)
+            throw runtime_error("the region file is full");
+        return static_cast<uint32_t>(offset);
+    }
+    void writeEntry(size_t i)
+    {
+        uint32_t location = makeLocation(header[i].location), timestamp = endianswap(header[i].timestamp);
+        file.seekp(4 * i);
+        file.write(reinterpret_cast<const char *>(&location), 4);
+        file.seekp(0x1000 + 4 * i);
+        file.write(reinterpret_cast<const char *>(&timestamp), 4);
+    }
+public:
+    /// Open a region file, which is created if it doesn't exist
+    explicit RegionWriter(const filesystem::path &path)
+    {
+        if (!filesystem::exists(path))
+            ofstream(path, ios::binary);
+        file.open(path, ios::in | ios::out | ios::binary);
+        if (!file)
+            throw runtime_error("failed to open the region file");
+        file.exceptions(fstream::eofbit | fstream::failbit | fstream::badbit);
+        size_t size = filesystem::file_size(path);
+        if (size == 0)
+        {
+            static const char zeros[0x2000]{};
+            file.write(zeros, sizeof(zeros));
+            size = sizeof(zeros);
+        }
+        else if (size < 0x2000)
+            throw runtime_error("the region file is too small");
+        uint32_t locations[1024], timestamps[1024];
+        file.seekg(0);
+        file.read(reinterpret_cast<char *>(&locations), sizeof(locations));
+        file.read(reinterpret_cast<char *>(&timestamps), sizeof(timestamps));
+        uses.assign((size + 0xFFF) / 0x1000, 0);
+        uses[0] = uses[1] = 1;
+        for (size_t i = 0; i < 1024; i++)
+        {
+            header[i] = {getLocation(locations[i]), endianswap(timestamps[i])};
+            if (header[i].exists())
+                mark(header[i].location.offset, header[i].location.count, 1);
+        }
+    }
+    /// The header, indexed by `x + 32 * z`
+    const array<HeaderEntry, 1024> &getHeader() const
+    {
+        return header;
+    }
+#ifdef LMCA_ZSTD
+    /// Set the dictionary for the chunks of compression type 127, which should be registered for reading them
+    void setDictionary(shared_ptr<const ZstdDictionary> dict)
+    {
+        dictionary = ::std::move(dict);
+    }
+#endif
+    /// Write a compressed chunk, such as a payload read from another region file
+    void writePayload(size_t x, size_t z, const Payload &payload, uint32_t timestamp = detail::now())
+    {
+        size_t i = x + 32 * z;
+        if (x >= 32 || z >= 32)
+            throw out_of_range("the chunk is out of the region");
+        uint8_t count = detail::sectorCount(payload.data.size());
+        HeaderEntry &entry = header[i];
+        SectorInfo location{0, count};
+        if (entry.exists() && count <= entry.location.count && exclusive(entry.location))
+        {
+            location.offset = entry.location.offset;
+            mark(location.offset + count, entry.location.count - count, -1);
+        }
+        else
+        {
+            if (entry.exists())
+                mark(entry.location.offset, entry.location.count, -1);
+            location.offset = allocate(count);
+            mark(location.offset, count, 1);
+        }
+        static const char zeros[0x1000]{};
+        char prefix[5];
+        detail::writeChunkHeader(prefix, payload.compression_type, payload.data.size());
+        file.seekp(0x1000 * size_t(location.offset));
+        file.write(prefix, 5);
+        file.write(payload.data.data(), payload.data.size());
+        file.write(zeros, 0x1000 * size_t(count) - 5 - payload.data.size());
+        entry = {location, timestamp};
+        writeEntry(i);
+    }
+    /// Compress and write the data of a chunk
+    void writeChunk(size_t x, size_t z, const NBT &data, uint8_t compression_type = 2, uint32_t timestamp = detail::now())
+    {
+#ifdef LMCA_ZSTD
+        span<const char> payload = detail::encode(data, compression_type, dictionary.get());
+#else
+        span<const char> payload = detail::encode(data, compression_type);
+#endif
+        writePayload(x, z, {compression_type, payload}, timestamp);
+    }
+    /// Remove a chunk by clearing its entries in the header and freeing its sectors
+    void removeChunk(size_t x, size_t z)
+    {
+        size_t i = x + 32 * z;
+        if (x >= 32 || z >= 32)
+            throw out_of_range("the chunk is out of the region");
+        if (header[i].exists())
+            mark(header[i].location.offset, header[i].location.count, -1);
+        header[i] = {};
+        writeEntry(i);
+    }
+    /// Write the chunks of a region and remove the chunks absent from it
+    void writeRegion(const Region &region, uint8_t compression_type = 2)
+    {
+        for (size_t i = 0; i < 1024; i++)
+        {
+            if (region[i])
+                writeChunk(i % 32, i / 32, region[i]->data, compression_type, region[i]->timestamp);
+            else if (header[i].exists())
+                removeChunk(i % 32, i / 32);
+        }
+    }
+    void flush()
+    {
+        file.flush();
+    }
+};
+/// Statistics of the headers of region files, and optionally of the 5-byte prefixes of their chunks, which are collected without decompressing chunks
+struct RegionStats
+{
+    size_t files = 0, chunks = 0;
+    /// The sectors after the headers, and those used by chunks, used by more than one chunk and used by none
+    size_t sectors = 0, used_sectors = 0, overlapping_sectors = 0, free_sectors = 0;
+    /// The chunks whose sectors are out of their files
+    size_t invalid_locations = 0;
+    /// The number of chunks by the number of their sectors in buckets of 1, 2, 3-4, 5-8, ..., 129-255
+    array<size_t, 9> sector_histogram{};
+    uint32_t min_timestamp = numeric_limits<uint32_t>::max(), max_timestamp = 0;
+    /// Whether the prefixes are read, which the statistics below need
+    bool prefixes = false;
+    /// The number of chunks by compression type, the chunks stored in external `.mcc` files for being oversized, and the chunks with invalid lengths
+    array<size_t, 128> compression_types{};
+    size_t oversized = 0, invalid_lengths = 0;
+    /// The size of the payloads, and the number of chunks by the size of their payloads in buckets of [2^(k-1), 2^k)
+    size_t payload_bytes = 0;
+    array<size_t, 33> size_histogram{};
+    void merge(const RegionStats &other)
+    {
+        files += other.files, chunks += other.chunks;
+        sectors += other.sectors, used_sectors += other.used_sectors, overlapping_sectors += other.overlapping_sectors, free_sectors += other.free_sectors;
+        invalid_locations += other.invalid_locations;
+        for (size_t i = 0; i < sector_histogram.size(); i++)
+            sector_histogram[i] += other.sector_histogram[i];
+        min_timestamp = min(min_timestamp, other.min_timestamp), max_timestamp = max(max_timestamp, other.max_timestamp);
+        prefixes = prefixes || other.prefixes;
+        for (size_t i = 0; i < compression_types.size(); i++)
+            compression_types[i] += other.compression_types[i];
+        oversized += other.oversized, invalid_lengths += other.invalid_lengths, payload_bytes += other.payload_bytes;
+        for (size_t i = 0; i < size_histogram.size(); i++)
+            size_histogram[i] += other.size_histogram[i];
+    }
+    void report(ostream &out) const
+    {
+        out << "files: " << files << "\n"
+            << "chunks: " << chunks << "\n"
+            << "sectors: " << sectors << " (" << used_sectors << " used, " << free_sectors << " free, " << overlapping_sectors << " overlapping)\n";
+        if (sectors != 0)
+            out << "free_ratio: " << 100.0 * free_sectors / sectors << " %\n";
+        out << "invalid_locations: " << invalid_locations << "\n";
+        for (size_t i = 0; i < sector_histogram.size(); i++)
+            if (sector_histogram[i] != 0)
+                out << "sectors_per_chunk." << (i < 2 ? to_string(i + 1) : to_string((1 << (i - 1)) + 1) + "-" + to_string(min(1 << i, 255))) << ": " << sector_histogram[i] << "\n";
+        if (chunks != 0)
+            out << "timestamps: " << min_timestamp << " - " << max_timestamp << "\n";
+        if (!prefixes)
+            return;
+        static constexpr const char *names[] = {"", "gzip", "zlib", "none", "lz4"};
+        for (size_t i = 0; i < compression_types.size(); i++)
+            if (compression_types[i] != 0)
+                out << "compression." << (i < size(names) && i != 0 ? names[i] : i == 127 ? "custom" : to_string(i)) << ": " << compression_types[i] << "\n";
+        out << "oversized: " << oversized << "\n"
+            << "invalid_lengths: " << invalid_lengths << "\n"
+            << "payload_bytes: " << payload_bytes << "\n";
+        if (used_sectors != 0)
+            out << "sector_utilization: " << 100.0 * payload_bytes / (0x1000 * double(used_sectors)) << " %\n";
+        for (size_t i = 0; i < size_histogram.size(); i++)
+            if (size_histogram[i] != 0)
+                out << "payload_size." << (i == 0 ? 0 : size_t(1) << (i - 1)) << "-" << (size_t(1) << i) - 1 << ": " << size_histogram[i] << "\n";
+    }
+};
+/// Collect statistics of the header of a region file, and of the prefixes of its chunks in the order of their sectors if `prefixes` is true
+/// A region file of 0 bytes, which the game may leave, is counted as a file without chunks
+inline RegionStats scanRegion(const filesystem::path &path, bool prefixes = false)
+{
+    NBT_TRACE_SPAN("read header");
+    RegionStats stats;
+    stats.files = 1, stats.prefixes = prefixes;
+    size_t size = filesystem::file_size(path);
+    if (size == 0)
+        return stats;
+    if (size < 0x2000)
+        throw runtime_error("the region file is too small");
+    ifstream in(path, ios::binary);
+    in.exceptions(istream::eofbit | istream::failbit | istream::badbit);
     uint32_t locations[1024], timestamps[1024];
-    region.read(reinterpret_cast<char *>(&locations), sizeof(locations));
-    region.read(reinterpret_cast<char *>(&timestamps), sizeof(timestamps));
-
-    Region ret;
+    in.read(reinterpret_cast<char *>(&locations), sizeof(locations));
+    in.read(reinterpret_cast<char *>(&timestamps), sizeof(timestamps));
+    size_t file_sectors = (size + 0xFFF) / 0x1000;
+    stats.sectors = file_sectors - 2;
+    vector<uint8_t> uses(file_sectors);
+    vector<SectorInfo> valid;
     for (size_t i = 0; i < 1024; i++)
     {
         SectorInfo location = getLocation(locations[i]);
-        if (location.offset >= 2 && location.count > 0)
-            ret[i] = optional(Chunk{endianswap(timestamps[i]), readChunk(region, location)});
+        if (location.offset < 2 || location.count == 0)
+            continue;
+        uint32_t timestamp = endianswap(timestamps[i]);
+        stats.chunks++;
+        stats.sector_histogram[bit_width(location.count - 1u)]++;
+        stats.min_timestamp = min(stats.min_timestamp, timestamp), stats.max_timestamp = max(stats.max_timestamp, timestamp);
+        if (location.offset + size_t(location.count) > file_sectors)
+        {
+            stats.invalid_locations++;
+            continue;
+        }
+        for (size_t k = location.offset; k < location.offset + size_t(location.count); k++)
+            uses[k] = min(uses[k] + 1, 2);
+        valid.push_back(location);
+    }
+    for (size_t k = 2; k < file_sectors; k++)
+        (uses[k] == 0 ? stats.free_sectors : uses[k] == 1 ? stats.used_sectors : stats.overlapping_sectors)++;
+    stats.used_sectors += stats.overlapping_sectors;
+    if (!prefixes)
+        return stats;
+    ranges::sort(valid, {}, &SectorInfo::offset);
+    for (SectorInfo location : valid)
+    {
+        char prefix[5];
+        in.seekg(0x1000 * size_t(location.offset));
+        in.read(prefix, 5);
+        uint32_t length;
+        memcpy(&length, prefix, 4);
+        length = endianswap(length);
+        uint8_t compression_type = prefix[4];
+        if (length == 0 || length > 0x1000 * size_t(location.count) - 4)
+        {
+            stats.invalid_lengths++;
+            continue;
+        }
+        stats.compression_types[compression_type & 0x7F]++;
+        if (compression_type & 0x80)
+            stats.oversized++;
+        stats.payload_bytes += length - 1;
+        stats.size_histogram[bit_width(length - 1)]++;
+    }
+    return stats;
+}
+/// Collect statistics of the headers of region files in parallel
+inline RegionStats scanRegions(const vector<filesystem::path> &files, bool prefixes = false, size_t threads = thread::hardware_concurrency())
+{
+    RegionStats ret;
+    ret.prefixes = prefixes;
+    atomic<size_t> next = 0;
+    exception_ptr error;
+    std::mutex mutex;
+    {
+        vector<jthread> workers;
+        for (size_t i = 0; i < max<size_t>(threads, 1); i++)
+            workers.emplace_back([&] {
+                RegionStats stats;
+                try
+                {
+                    for (size_t i = next++; i < files.size(); i = next++)
+                        stats.merge(scanRegion(files[i], prefixes));
+                }
+                catch (...)
+                {
+                    lock_guard lock(mutex);
+                    if (!error)
+                        error = current_exception();
+                    next = files.size();
+                }
+                lock_guard lock(mutex);
+                ret.merge(stats);
+            });
     }
+    if (error)
+        rethrow_exception(error);
     return ret;
 }
-Region readRegion(istream &&region)
+#if __has_include(<sys/mman.h>)
+namespace detail
 {
-    return readRegion(region);
+#if __has_include(<linux/io_uring.h>) && __has_include(<sys/syscall.h>)
+/// An io_uring instance set up by raw system calls, which submits vectored reads and reaps their completions
+class IoUring
+{
+    int fd = -1;
+    io_uring_params params{};
+    void *sq_ring = MAP_FAILED, *cq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0, cq_ring_size = 0;
+    io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe *cqes;
+    unsigned queued = 0;
+    template <typename T>
+    static T *at(void *ring, unsigned offset)
+    {
+        return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+    }
+    void unmap()
+    {
+        if (sqes != MAP_FAILED)
+            ::munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+            ::munmap(cq_ring, cq_ring_size);
+        if (sq_ring != MAP_FAILED)
+            ::munmap(sq_ring, sq_ring_size);
+        if (fd != -1)
+            ::close(fd);
+    }
+public:
+    /// Set up an io_uring instance, which throws `system_error` if io_uring is unavailable, such as on kernels before 5.1 or under seccomp filters
+    explicit IoUring(unsigned entries)
+    {
+        fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0)
+            throw system_error(errno, generic_category(), "io_uring_setup() error");
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+            sq_ring_size = cq_ring_size = max(sq_ring_size, cq_ring_size);
+        sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cq_ring = single ? sq_ring : ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes = static_cast<io_uring_sqe *>(::mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED)
+        {
+            int err = errno;
+            unmap();
+            throw system_error(err, generic_category(), "mmap() error");
+        }
+        sq_head = at<unsigned>(sq_ring, params.sq_off.head), sq_tail = at<unsigned>(sq_ring, params.sq_off.tail);
+        sq_mask = at<unsigned>(sq_ring, params.sq_off.ring_mask), sq_array = at<unsigned>(sq_ring, params.sq_off.array);
+        cq_head = at<unsigned>(cq_ring, params.cq_off.head), cq_tail = at<unsigned>(cq_ring, params.cq_off.tail);
+        cq_mask = at<unsigned>(cq_ring, params.cq_off.ring_mask), cqes = at<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+    }
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+    ~IoUring()
+    {
+        unmap();
+    }
+    /// Queue a vectored read, whose `iovec`s must be valid until it completes, or return false if the submission queue is full
+    bool readv(int file, const iovec *iov, unsigned count, uint64_t offset, uint64_t user_data)
+    {
+        unsigned tail = *sq_tail;
+        if (tail - atomic_ref(*sq_head).load(memory_order_acquire) == params.sq_entries)
+            return false;
+        unsigned index = tail & *sq_mask;
+        io_uring_sqe &sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READV;
+        sqe.fd = file;
+        sqe.addr = reinterpret_cast<uint64_t>(iov);
+        sqe.len = count;
+        sqe.off = offset;
+        sqe.user_data = user_data;
+        sq_array[index] = index;
+        atomic_ref(*sq_tail).store(tail + 1, memory_order_release);
+        queued++;
+        return true;
+    }
+    /// Submit the queued reads and wait for at least `wait` completions
+    void submit(unsigned wait)
+    {
+        for (;;)
+        {
+            int ret = static_cast<int>(::syscall(__NR_io_uring_enter, fd, queued, wait, wait != 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+            if (ret >= 0)
+            {
+                queued -= ret;
+                return;
+            }
+            if (errno != EINTR)
+                throw system_error(errno, generic_category(), "io_uring_enter() error");
+        }
+    }
+    /// Call `f(user_data, result)` for each completion, whose result is the bytes read or a negative errno
+    template <typename F>
+    void reap(F &&f)
+    {
+        unsigned head = *cq_head;
+        for (unsigned tail = atomic_ref(*cq_tail).load(memory_order_acquire); head != tail; head++)
+        {
+            const io_uring_cqe &cqe = cqes[head & *cq_mask];
+            uint64_t user_data = cqe.user_data;
+            int res = cqe.res;
+            atomic_ref(*cq_head).store(head + 1, memory_order_release);
+            f(user_data, res);
+        }
+    }
+};
+#endif
+/// A queue of reads of files, which are submitted in batches and completed asynchronously by io_uring on Linux, or by `preadv` one by one if io_uring is unavailable
+/// A read may scatter a range of a file into several buffers, such as the sectors of adjacent chunks
+class ReadQueue
+{
+public:
+    /// The maximum buffers of a read
+    static constexpr size_t max_iovecs = 16;
+private:
+    struct Slot
+    {
+        iovec iov[max_iovecs];
+        unsigned count;
+        int fd;
+        off_t offset;
+        uint64_t user_data;
+    };
+    vector<Slot> slots;
+    vector<uint32_t> free_slots, queued;
+#if __has_include(<linux/io_uring.h>) && __has_include(<sys/syscall.h>)
+    unique_ptr<IoUring> ring;
+#endif
+public:
+    /// Create a queue of reads in flight up to a depth, using io_uring if `io_uring` is true and it is available
+    explicit ReadQueue(size_t depth, bool io_uring = true) : slots(max<size_t>(depth, 1))
+    {
+        for (size_t i = slots.size(); i-- > 0;)
+            free_slots.push_back(static_cast<uint32_t>(i));
+#if __has_include(<linux/io_uring.h>) && __has_include(<sys/syscall.h>)
+        if (io_uring)
+            try
+            {
+                ring = make_unique<IoUring>(static_cast<unsigned>(bit_ceil(slots.size())));
+            }
+            catch (const system_error &)
+            {
+            }
+#endif
+    }
+    /// Whether the reads are completed by io_uring
+    bool async() const
+    {
+#if __has_include(<linux/io_uring.h>) && __has_include(<sys/syscall.h>)
+        return ring != nullptr;
+#else
+        return false;
+#endif
+    }
+    bool full() const
+    {
+        return free_slots.empty();
+    }
+    size_t inFlight() const
+    {
+        return slots.size() - free_slots.size();
+    }
+    /// Queue a read of a file into consecutive buffers, at most `max_iovecs`, which must not be full
+    void read(int fd, span<const iovec> buffers, off_t offset, uint64_t user_data)
+    {
+        if (buffers.empty() || buffers.size() > max_iovecs)
+            throw out_of_range("invalid number of buffers of a read");
+        uint32_t i = free_slots.back();
+        free_slots.pop_back();
+        Slot &slot = slots[i];
+        ranges::copy(buffers, slot.iov);
+        slot.count = static_cast<unsigned>(buffers.size()), slot.fd = fd, slot.offset = offset, slot.user_data = user_data;
+#if __has_include(<linux/io_uring.h>) && __has_include(<sys/syscall.h>)
+        if (ring)
+        {
+            ring->readv(fd, slot.iov, slot.count, offset, i);
+            return;
+        }
+#endif
+        queued.push_back(i);
+    }
+    /// Queue a read of a file into a buffer, which must not be full
+    void read(int fd, char *buffer, size_t size, off_t offset, uint64_t user_data)
+    {
+        iovec iov{buffer, size};
+        read(fd, span(&iov, 1), offset, user_data);
+    }
+    /// Submit the queued reads and wait for at least one of them unless `block` is false, calling `f(user_data, result)` for each finished read, whose result is the bytes read (fewer only at the end of the file) or a negative errno
+    template <typename F>
+    void wait(F &&f, bool block = true)
+    {
+        auto finish = [this, &f](uint32_t i, ssize_t result) {
+            uint64_t user_data = slots[i].user_data;
+            free_slots.push_back(i);
+            f(user_data, result);
+        };
+#if __has_include(<linux/io_uring.h>) && __has_include(<sys/syscall.h>)
+        if (ring)
+        {
+            ring->submit(block ? 1 : 0);
+            ring->reap([&finish](uint64_t i, int result) { finish(static_cast<uint32_t>(i), result); });
+            return;
+        }
+#endif
+        while (!queued.empty())
+        {
+            uint32_t i = queued.front();
+            queued.erase(queued.begin());
+            Slot &slot = slots[i];
+            iovec *iov = slot.iov;
+            unsigned count = slot.count;
+            size_t done = 0;
+            ssize_t result = 0;
+            while (count != 0)
+            {
+                result = ::preadv(slot.fd, iov, static_cast<int>(count), slot.offset + done);
+                if (result < 0 && errno == EINTR)
+                    continue;
+                if (result <= 0)
+                    break;
+                done += result;
+                // skip the filled buffers and continue into the partially filled one
+                size_t rest = result;
+                for (; count != 0 && rest >= iov->iov_len; iov++, count--)
+                    rest -= iov->iov_len;
+                if (count != 0)
+                    iov->iov_base = static_cast<char *>(iov->iov_base) + rest, iov->iov_len -= rest;
+            }
+            finish(i, result < 0 ? -errno : static_cast<ssize_t>(done));
+        }
+    }
+};
+/// A file descriptor closed on destruction
+class FileDescriptor
+{
+    int fd;
+public:
+    explicit FileDescriptor(const filesystem::path &path) : fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC))
+    {
+        if (fd == -1)
+            throw system_error(errno, generic_category(), "open() error");
+    }
+    FileDescriptor(const FileDescriptor &) = delete;
+    FileDescriptor &operator=(const FileDescriptor &) = delete;
+    ~FileDescriptor()
+    {
+        ::close(fd);
+    }
+    int get() const
+    {
+        return fd;
+    }
+    /// Advise the kernel of the access pattern of the file by `posix_fadvise`, such as `POSIX_FADV_SEQUENTIAL`, which is only a hint and whose errors are ignored
+    void advise(int advice, off_t offset = 0, off_t size = 0) const noexcept
+    {
+        ::posix_fadvise(fd, offset, size, advice);
+    }
+};
+} // namespace detail
+#endif
+namespace detail
+{
+/// A bounded lock-free multi-producer multi-consumer queue of a ring of cells with sequence numbers, where blocking operations wait on counters by `atomic::wait`
+template <typename T>
+class BoundedQueue
+{
+    struct Cell
+    {
+        atomic<size_t> sequence;
+        T value;
+    };
+    unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) atomic<size_t> head = 0; // the position of the next push
+    alignas(64) atomic<size_t> tail = 0; // the position of the next pop
+    alignas(64) atomic<uint32_t> pushes = 0, pops = 0;
+    atomic<bool> closed = false, aborted = false;
+public:
+    /// Create a queue whose capacity is rounded up to a power of two
+    explicit BoundedQueue(size_t capacity) : cells(new Cell[bit_ceil(max<size_t>(capacity, 2))]), mask(bit_ceil(max<size_t>(capacity, 2)) - 1)
+    {
+        for (size_t i = 0; i <= mask; i++)
+            cells[i].sequence.store(i, memory_order_relaxed);
+    }
+    size_t capacity() const
+    {
+        return mask + 1;
+    }
+    bool tryPush(T &value)
+    {
+        size_t pos = head.load(memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = cells[pos & mask];
+            ptrdiff_t diff = static_cast<ptrdiff_t>(cell.sequence.load(memory_order_acquire) - pos);
+            if (diff == 0)
+            {
+                if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                {
+                    cell.value = ::std::move(value);
+                    cell.sequence.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = head.load(memory_order_relaxed);
+        }
+    }
+    bool tryPop(T &value)
+    {
+        size_t pos = tail.load(memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = cells[pos & mask];
+            ptrdiff_t diff = static_cast<ptrdiff_t>(cell.sequence.load(memory_order_acquire) - (pos + 1));
+            if (diff == 0)
+            {
+                if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                {
+                    value = ::std::move(cell.value);
+                    cell.sequence.store(pos + mask + 1, memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = tail.load(memory_order_relaxed);
+        }
+    }
+    /// Push a value, waiting while the queue is full, or return false if the queue is aborted
+    bool push(T value)
+    {
+        for (;;)
+        {
+            uint32_t version = pops.load(memory_order_acquire);
+            if (aborted.load(memory_order_acquire))
+                return false;
+            if (tryPush(value))
+            {
+                pushes.fetch_add(1, memory_order_release);
+                pushes.notify_one();
+                return true;
+            }
+            pops.wait(version, memory_order_acquire);
+        }
+    }
+    /// Pop a value, waiting while the queue is empty, or return false if the queue is aborted or closed and empty
+    bool pop(T &value)
+    {
+        for (;;)
+        {
+            uint32_t version = pushes.load(memory_order_acquire);
+            if (aborted.load(memory_order_acquire))
+                return false;
+            bool last = closed.load(memory_order_acquire);
+            if (tryPop(value))
+            {
+                pops.fetch_add(1, memory_order_release);
+                pops.notify_one();
+                return true;
+            }
+            if (last)
+                return false;
+            pushes.wait(version, memory_order_acquire);
+        }
+    }
+    /// Close the queue after the last push, which lets the consumers finish
+    void close()
+    {
+        closed.store(true, memory_order_release);
+        pushes.fetch_add(1, memory_order_release);
+        pushes.notify_all();
+    }
+    /// Abort the queue, which wakes all the waiting producers and consumers
+    void abort()
+    {
+        aborted.store(true, memory_order_release);
+        pushes.fetch_add(1, memory_order_release);
+        pops.fetch_add(1, memory_order_release);
+        pushes.notify_all();
+        pops.notify_all();
+    }
+};
+/// A chunk passed between the stages of a pipeline, whose buffer belongs to the buffer pool of the pipeline
+struct PipelineItem
+{
+    uint32_t file;
+    uint32_t index;
+    uint32_t timestamp;
+    uint8_t compression_type;
+    Buffer *buffer;
+    /// The bytes before the data in the buffer, such as the prefix of a chunk read with its sectors
+    uint32_t skip = 0;
+    span<const char> data() const
+    {
+        return span<const char>(buffer->data() + skip, buffer->size - skip);
+    }
+};
+/// A parsed chunk passed to the sink of a pipeline
+struct ParsedItem
+{
+    uint32_t file;
+    uint32_t index;
+    Chunk chunk;
+};
+} // namespace detail
+/// The options of `runPipeline`
+struct PipelineOptions
+{
+    /// The number of threads of each stage
+    size_t read_threads = 2, inflate_threads = max<size_t>(thread::hardware_concurrency() / 2, 1), parse_threads = max<size_t>(thread::hardware_concurrency() / 2, 1), sink_threads = 1;
+    /// The capacity of each queue between stages
+    size_t queue_capacity = 64;
+    /// The number of reads in flight of each read thread, which are submitted in batches by io_uring on Linux if `io_uring` is true and it is available, or else done by `pread`
+    size_t queue_depth = 32;
+    bool io_uring = true;
+    /// A token for cancelling, after which the stages stop as soon as possible
+    stop_token stop;
+};
+/// Process the chunks of region files by a pipeline of stages of reading sectors, decompressing, parsing and calling `sink(file, x, z, chunk)`, returning the number of chunks passed to the sink
+/// Each stage has its own threads, and the stages are connected by bounded lock-free queues, which block the earlier stages when the later ones fall behind
+/// The headers and the sectors of chunks are read asynchronously with many reads in flight, and both the compressed and the decompressed data are kept in buffers from a fixed pool, so the memory is bounded by the queues and the threads
+/// `sink` is called by the sink threads at the same time if there are more than one; an exception from any stage cancels the pipeline and is rethrown
+template <typename Sink>
+    requires invocable<Sink &, size_t, size_t, size_t, Chunk &>
+size_t runPipeline(const vector<filesystem::path> &files, Sink &&sink, const PipelineOptions &options = {})
+{
+    using detail::Buffer, detail::BoundedQueue, detail::PipelineItem, detail::ParsedItem;
+    size_t read_threads = max<size_t>(options.read_threads, 1), inflate_threads = max<size_t>(options.inflate_threads, 1);
+    size_t parse_threads = max<size_t>(options.parse_threads, 1), sink_threads = max<size_t>(options.sink_threads, 1);
+    BoundedQueue<PipelineItem> compressed(options.queue_capacity), decompressed(options.queue_capacity);
+    BoundedQueue<ParsedItem> parsed(options.queue_capacity);
+    // a buffer is held by a read in flight, waits in a queue, or is held by a parser, or one or two are held by a decompressor, so there is always one for the next decompressor
+    size_t queue_depth = max<size_t>(options.queue_depth, 1);
+    size_t buffer_count = read_threads * queue_depth + compressed.capacity() + 2 * inflate_threads + decompressed.capacity() + parse_threads;
+    unique_ptr<Buffer[]> buffers(new Buffer[buffer_count]);
+    BoundedQueue<Buffer *> pool(buffer_count);
+    for (size_t i = 0; i < buffer_count; i++)
+    {
+        Buffer *buffer = &buffers[i];
+        pool.tryPush(buffer);
+    }
+    atomic<size_t> processed = 0, next = 0;
+    exception_ptr error;
+    std::mutex mutex;
+    auto abort = [&] {
+        compressed.abort(), decompressed.abort(), parsed.abort(), pool.abort();
+    };
+    auto fail = [&] {
+        {
+            lock_guard lock(mutex);
+            if (!error)
+                error = current_exception();
+        }
+        abort();
+    };
+    stop_callback cancel(options.stop, abort);
+    {
+        vector<jthread> workers;
+        // start the threads of a stage, the last of which to finish closes the queue to the next stage
+        auto stage = [&workers, &fail](size_t threads, auto finish, auto body) {
+            auto active = make_shared<atomic<size_t>>(threads);
+            for (size_t i = 0; i < threads; i++)
+                workers.emplace_back([&fail, active, finish, body] {
+                    try
+                    {
+                        body();
+                    }
+                    catch (...)
+                    {
+                        fail();
+                    }
+                    if (--*active == 0)
+                        finish();
+                });
+        };
+#if __has_include(<sys/mman.h>)
+        stage(read_threads, [&] { compressed.close(); }, [&] {
+            // the region files being read, whose headers are read first and then the sectors of their chunks in order
+            struct File
+            {
+                detail::FileDescriptor fd;
+                char header[0x2000];
+                vector<pair<SectorInfo, uint32_t>> chunks;
+                size_t size, next = 0, reading = 1;
+                explicit File(const filesystem::path &path) : fd(path)
+                {
+                    struct stat st;
+                    if (::fstat(fd.get(), &st) == -1)
+                        throw system_error(errno, generic_category(), "fstat() error");
+                    size = st.st_size;
+                    fd.advise(POSIX_FADV_SEQUENTIAL);
+                }
+            };
+            // a read in flight of the header of a file, or of the sectors of adjacent chunks from `chunks[index]` into a buffer for each chunk, of which `done` bytes have been read
+            struct Read
+            {
+                uint32_t file, index, count;
+                size_t done;
+                Buffer *buffers[detail::ReadQueue::max_iovecs];
+            };
+            constexpr uint32_t header = numeric_limits<uint32_t>::max();
+            map<uint32_t, File> reading;
+            vector<Read> reads(queue_depth);
+            vector<uint32_t> free_reads;
+            for (size_t r = queue_depth; r-- > 0;)
+                free_reads.push_back(static_cast<uint32_t>(r));
+            detail::ReadQueue queue(queue_depth, options.io_uring);
+            size_t max_files = max<size_t>(queue_depth / 8, 2), held = 0; // the buffers held by the reads in flight, which are at most `queue_depth` as the pool counts
+            auto release = [&pool, &reads, &held](uint32_t r) {
+                for (uint32_t k = 0; k < reads[r].count; k++)
+                    pool.push(reads[r].buffers[k]);
+                held -= reads[r].count;
+                reads[r].count = 0;
+            };
+            // the offset and the size of the range of a read in its file
+            auto range = [&reading](const Read &read) -> pair<size_t, size_t> {
+                const File &file = reading.at(read.file);
+                if (read.index == header)
+                    return {0, sizeof(file.header)};
+                size_t size = 0;
+                for (uint32_t k = 0; k < read.count; k++)
+                    size += 0x1000 * size_t(file.chunks[read.index + k].first.count);
+                return {0x1000 * size_t(file.chunks[read.index].first.offset), size};
+            };
+            // queue the rest of a read after the bytes done
+            auto submit = [&](uint32_t r) {
+                const Read &read = reads[r];
+                File &file = reading.at(read.file);
+                iovec iov[detail::ReadQueue::max_iovecs];
+                size_t count = 0, skip = read.done;
+                if (read.index == header)
+                    iov[count++] = {file.header + skip, sizeof(file.header) - skip};
+                else
+                    for (uint32_t k = 0; k < read.count; k++)
+                    {
+                        size_t size = 0x1000 * size_t(file.chunks[read.index + k].first.count);
+                        if (skip >= size)
+                            skip -= size;
+                        else
+                            iov[count++] = {read.buffers[k]->data() + skip, size - skip}, skip = 0;
+                    }
+                queue.read(file.fd.get(), span(iov, count), off_t(range(read).first + read.done), r);
+            };
+            bool aborted = false;
+            // the reads in flight write into their buffers until they complete
+            auto drain = [&] {
+                while (queue.inFlight() != 0)
+                    queue.wait([&](uint64_t user_data, ssize_t) { release(static_cast<uint32_t>(user_data)); });
+            };
+            try
+            {
+                for (;;)
+                {
+                    // fill the queue with the sectors of the files being read, and with the headers of more files
+                    while (!queue.full())
+                    {
+                        auto file = ranges::find_if(reading, [](const auto &file) { return file.second.next < file.second.chunks.size(); });
+                        if (file != reading.end())
+                        {
+                            // the sectors of the next chunks are read together while they are adjacent in the file
+                            File &opened = file->second;
+                            uint32_t r = free_reads.back();
+                            Read &read = reads[r];
+                            read = {file->first, static_cast<uint32_t>(opened.next), 0, 0, {}};
+                            size_t begin = 0x1000 * size_t(opened.chunks[opened.next].first.offset), end = begin;
+                            while (read.count < detail::ReadQueue::max_iovecs && opened.next < opened.chunks.size() && held < queue_depth)
+                            {
+                                SectorInfo location = opened.chunks[opened.next].first;
+                                if (0x1000 * size_t(location.offset) != end || end - begin >= detail::max_run)
+                                    break;
+                                Buffer *buffer;
+                                if (!(queue.inFlight() == 0 && read.count == 0 ? pool.pop(buffer) : pool.tryPop(buffer)))
+                                    break;
+                                size_t size = 0x1000 * size_t(location.count);
+                                buffer->size = 0;
+                                buffer->reserve(size);
+                                read.buffers[read.count++] = buffer;
+                                held++, opened.next++, end += size;
+                            }
+                            if (read.count == 0)
+                                break;
+                            free_reads.pop_back();
+                            opened.reading++;
+                            submit(r);
+                            continue;
+                        }
+                        if (reading.size() >= max_files)
+                            break;
+                        size_t i = next++;
+                        if (i >= files.size())
+                            break;
+                        if (filesystem::file_size(files[i]) == 0)
+                            continue;
+                        reading.try_emplace(static_cast<uint32_t>(i), files[i]);
+                        uint32_t r = free_reads.back();
+                        free_reads.pop_back();
+                        reads[r] = {static_cast<uint32_t>(i), header, 0, 0, {}};
+                        submit(r);
+                    }
+                    if (queue.inFlight() == 0)
+                        return;
+                    if (aborted)
+                        break;
+                    queue.wait([&](uint64_t user_data, ssize_t result) {
+                        uint32_t r = static_cast<uint32_t>(user_data);
+                        Read &read = reads[r];
+                        File &file = reading.at(read.file);
+                        if (result >= 0)
+                        {
+                            // a read may be short before the end of the file, after which the rest is read again
+                            read.done += result;
+                            auto [begin, size] = range(read);
+                            if (result > 0 && read.done < size && begin + read.done < file.size)
+                            {
+                                submit(r);
+                                return;
+                            }
+                        }
+                        free_reads.push_back(r);
+                        file.reading--;
+                        if (result < 0)
+                        {
+                            release(r);
+                            throw system_error(static_cast<int>(-result), generic_category(), "read() error");
+                        }
+                        if (read.index == header)
+                        {
+                            if (read.done < 0x2000)
+                                throw runtime_error("the region file is too small");
+                            for (uint32_t k = 0; k < 1024; k++)
+                            {
+                                uint32_t location;
+                                memcpy(&location, file.header + 4 * k, 4);
+                                if (SectorInfo info = getLocation(location); info.offset >= 2 && info.count > 0)
+                                    file.chunks.emplace_back(info, k);
+                            }
+                            ranges::sort(file.chunks, {}, [](const auto &chunk) { return chunk.first.offset; });
+                        }
+                        else
+                        {
+                            // the sectors may end early at the end of the file, which must still contain the whole payloads
+                            size_t offset = 0;
+                            while (read.count != 0)
+                            {
+                                auto [location, index] = file.chunks[read.index];
+                                Buffer *buffer = read.buffers[0];
+                                size_t size = 0x1000 * size_t(location.count), available = read.done > offset ? min(read.done - offset, size) : 0;
+                                uint32_t length = 0, timestamp;
+                                if (available >= 5)
+                                    memcpy(&length, buffer->data(), 4);
+                                length = endianswap(length);
+                                if (length == 0 || length > available - 4)
+                                {
+                                    release(r);
+                                    throw runtime_error("invalid chunk length");
+                                }
+                                buffer->size = 4 + length;
+                                memcpy(&timestamp, file.header + 0x1000 + 4 * index, 4);
+                                // the buffer belongs to the queue once it is pushed
+                                ranges::copy(span(read.buffers + 1, --read.count), read.buffers);
+                                held--, read.index++, offset += size;
+                                if (aborted || !compressed.push({read.file, index, endianswap(timestamp), static_cast<uint8_t>(buffer->data()[4]), buffer, 5}))
+                                    aborted = true;
+                            }
+                        }
+                        if (file.reading == 0 && file.next == file.chunks.size())
+                            reading.erase(read.file);
+                    });
+                }
+            }
+            catch (...)
+            {
+                drain();
+                throw;
+            }
+            drain();
+        });
+#else
+        stage(read_threads, [&] { compressed.close(); }, [&] {
+            for (size_t i = next++; i < files.size(); i = next++)
+            {
+                if (filesystem::file_size(files[i]) == 0)
+                    continue;
+                ifstream in(files[i], ios::binary);
+                in.exceptions(istream::eofbit | istream::failbit | istream::badbit);
+                uint32_t locations[1024], timestamps[1024];
+                in.read(reinterpret_cast<char *>(&locations), sizeof(locations));
+                in.read(reinterpret_cast<char *>(&timestamps), sizeof(timestamps));
+                vector<pair<SectorInfo, uint32_t>> chunks;
+                for (uint32_t j = 0; j < 1024; j++)
+                    if (SectorInfo location = getLocation(locations[j]); location.offset >= 2 && location.count > 0)
+                        chunks.emplace_back(location, j);
+                ranges::sort(chunks, {}, [](const auto &chunk) { return chunk.first.offset; });
+                for (auto [location, j] : chunks)
+                {
+                    Buffer *buffer;
+                    if (!pool.pop(buffer))
+                        return;
+                    Payload payload = detail::readPayload(in, location, *buffer);
+                    if (!compressed.push({static_cast<uint32_t>(i), j, endianswap(timestamps[j]), payload.compression_type, buffer}))
+                        return;
+                }
+            }
+        });
+#endif
+        stage(inflate_threads, [&] { decompressed.close(); }, [&] {
+            PipelineItem item;
+            while (compressed.pop(item))
+            {
+                if (item.compression_type != 3) // uncompressed data is parsed from the buffer it is read into
+                {
+                    Buffer *data;
+                    if (!pool.pop(data))
+                        return;
+                    detail::decompress(item.compression_type, item.data(), *data);
+                    pool.push(item.buffer);
+                    item.buffer = data, item.skip = 0;
+                }
+                if (!decompressed.push(item))
+                    return;
+            }
+        });
+        stage(parse_threads, [&] { parsed.close(); }, [&] {
+            PipelineItem item;
+            while (decompressed.pop(item))
+            {
+                NBT data = bin::read(ispanstream(item.data()));
+                pool.push(item.buffer);
+                if (!parsed.push({item.file, item.index, Chunk{item.timestamp, ::std::move(data)}}))
+                    return;
+            }
+        });
+        stage(sink_threads, [] {}, [&] {
+            ParsedItem item;
+            while (parsed.pop(item))
+            {
+                sink(size_t(item.file), size_t(item.index % 32), size_t(item.index / 32), item.chunk);
+                processed++;
+            }
+        });
+    }
+    if (error)
+        rethrow_exception(error);
+    return processed;
+}
+#if __has_include(<sys/mman.h>)
+/// A memory-mapped region file, which reads chunks directly from the page cache without streams or seeks
+class RegionFile
+{
+    MappedFile file;
+    array<HeaderEntry, 1024> header;
+public:
+    explicit RegionFile(const filesystem::path &path) : file(path)
+    {
+        NBT_TRACE_SPAN("read header");
+        if (file.size() < 0x2000)
+            throw runtime_error("the region file is too small");
+        for (size_t i = 0; i < 1024; i++)
+        {
+            uint32_t location, timestamp;
+            memcpy(&location, file.data() + 4 * i, 4);
+            memcpy(&timestamp, file.data() + 0x1000 + 4 * i, 4);
+            header[i] = {getLocation(location), endianswap(timestamp)};
+        }
+    }
+    /// Get the parsed header, which is indexed by `x + 32 * z`
+    const array<HeaderEntry, 1024> &getHeader() const
+    {
+        return header;
+    }
+    /// Get the entry of a chunk by its local coordinates within a region
+    const HeaderEntry &getEntry(size_t x, size_t z) const
+    {
+        return header.at(x + 32 * z);
+    }
+    /// Get the compressed payload of a chunk by its index, which refers to the mapped file
+    Payload getPayload(size_t i) const
+    {
+        const HeaderEntry &entry = header.at(i);
+        if (entry.location.offset == 0 && entry.location.count == 0)
+            throw runtime_error("the chunk doesn't exist in the region file");
+        else if (entry.location.offset < 2)
+            throw runtime_error("sector overlaps with header");
+        else if (entry.location.count == 0)
+            throw runtime_error("size has to be > 0");
+        size_t begin = 0x1000 * size_t(entry.location.offset);
+        if (begin + 5 > file.size())
+            throw runtime_error("sector is out of the region file");
+        uint32_t length;
+        memcpy(&length, file.data() + begin, 4);
+        length = endianswap(length);
+        detail::checkLength(length, min(file.size() - begin, 0x1000 * size_t(entry.location.count)));
+        return {static_cast<uint8_t>(file.data()[begin + 4]), span(file.data() + begin + 5, length - 1)};
+    }
+    /// Get the compressed payload of a chunk by its local coordinates within a region
+    Payload getPayload(size_t x, size_t z) const
+    {
+        return getPayload(x + 32 * z);
+    }
+    /// Read the data of a chunk by its index
+    NBT readChunkData(size_t i) const
+    {
+        Payload payload = getPayload(i);
+        return detail::decode(payload.compression_type, payload.data);
+    }
+    /// Read the data of a chunk by its index and update statistics
+    NBT readChunkData(size_t i, bin::Stats &stats) const
+    {
+        Payload payload = getPayload(i);
+        return detail::decode(payload.compression_type, payload.data, stats);
+    }
+    /// Read a chunk by its local coordinates within a region
+    Chunk readChunk(size_t x, size_t z) const
+    {
+        return {getEntry(x, z).timestamp, readChunkData(x + 32 * z)};
+    }
+    /// Read a chunk by its local coordinates within a region and update statistics
+    Chunk readChunk(size_t x, size_t z, bin::Stats &stats) const
+    {
+        return {getEntry(x, z).timestamp, readChunkData(x + 32 * z, stats)};
+    }
+    /// Get the indices of the existing chunks in the order of their sectors, in which reading them walks the file forward
+    vector<size_t> getSectorOrder() const
+    {
+        vector<size_t> order;
+        for (size_t i = 0; i < 1024; i++)
+            if (header[i].exists())
+                order.push_back(i);
+        ranges::sort(order, {}, [this](size_t i) { return header[i].location.offset; });
+        return order;
+    }
+    /// Advise the kernel to read the sectors of chunks ahead, such as before reading all the chunks
+    void prefetch() const noexcept
+    {
+        file.advise(MADV_WILLNEED, 0x2000);
+    }
+    /// Read all the chunks
+    /// The chunks are read in the order of their sectors with sequential readahead, and placed by their indices
+    Region readRegion() const
+    {
+        return readAll([this](size_t i) { return readChunkData(i); });
+    }
+    /// Read all the chunks and update statistics
+    Region readRegion(bin::Stats &stats) const
+    {
+        return readAll([this, &stats](size_t i) { return readChunkData(i, stats); });
+    }
+private:
+    template <typename Read>
+    Region readAll(Read &&read) const
+    {
+        Region ret;
+        file.advise(MADV_SEQUENTIAL);
+        prefetch();
+        try
+        {
+            for (size_t i : getSectorOrder())
+                ret[i] = optional(Chunk{header[i].timestamp, read(i)});
+        }
+        catch (...)
+        {
+            file.advise(MADV_NORMAL);
+            throw;
+        }
+        // the mapping may be kept for random access
+        file.advise(MADV_NORMAL);
+        return ret;
+    }
+};
+/// Read a region file by decoding its chunks in parallel with an executor
+/// `executor(task)` should run `task()` asynchronously, like submitting it to a thread pool, and it returns after all the tasks finish
+template <typename Executor>
+    requires invocable<Executor &, function<void()>>
+Region readRegionParallel(const filesystem::path &path, Executor &&executor)
+{
+    RegionFile file(path);
+    Region ret;
+    exception_ptr error;
+    vector<size_t> order = file.getSectorOrder();
+    size_t remaining = order.size();
+    std::mutex mutex;
+    condition_variable finished;
+    if (remaining == 0)
+        return ret;
+    file.prefetch();
+    size_t submitted = 0;
+    try
+    {
+        for (size_t i : order)
+        {
+            executor(function<void()>([&, i] {
+                try
+                {
+                    ret[i] = optional(Chunk{file.getHeader()[i].timestamp, file.readChunkData(i)});
+                }
+                catch (...)
+                {
+                    lock_guard lock(mutex);
+                    if (!error)
+                        error = current_exception();
+                }
+                lock_guard lock(mutex);
+                if (--remaining == 0)
+                    finished.notify_one();
+            }));
+            submitted++;
+        }
+    }
+    catch (...)
+    {
+        // the submitted tasks refer to the locals, so they are waited for before the exception leaves
+        unique_lock lock(mutex);
+        remaining -= order.size() - submitted;
+        finished.wait(lock, [&remaining] { return remaining == 0; });
+        throw;
+    }
+    unique_lock lock(mutex);
+    finished.wait(lock, [&remaining] { return remaining == 0; });
+    if (error)
+        rethrow_exception(error);
+    return ret;
+}
+/// Read a region file by decoding its chunks in parallel with threads
+inline Region readRegionParallel(const filesystem::path &path, size_t threads = thread::hardware_concurrency())
+{
+    RegionFile file(path);
+    Region ret;
+    vector<size_t> order = file.getSectorOrder();
+    atomic<size_t> next = 0;
+    exception_ptr error;
+    std::mutex mutex;
+    file.prefetch();
+    {
+        vector<jthread> workers;
+        for (size_t i = 0; i < max<size_t>(threads, 1); i++)
+            workers.emplace_back([&] {
+                for (size_t k = next++; k < order.size(); k = next++)
+                    try
+                    {
+                        size_t i = order[k];
+                        ret[i] = optional(Chunk{file.getHeader()[i].timestamp, file.readChunkData(i)});
+                    }
+                    catch (...)
+                    {
+                        lock_guard lock(mutex);
+                        if (!error)
+                            error = current_exception();
+                        next = order.size();
+                    }
+            });
+    }
+    if (error)
+        rethrow_exception(error);
+    return ret;
+}
+/// A region file whose chunks are decoded on first access and cached, evicting the least recently used clean chunks beyond a budget of bytes
+/// The memory usage of a chunk is estimated by `memoryUsage`, and a chunk is kept alive by the pointers to it after eviction
+/// Modified chunks are dirty and stay in memory until they are saved; a lazy region is not synchronized
+class LazyRegion
+{
+    struct Slot
+    {
+        shared_ptr<Chunk> chunk;
+        size_t size = 0;
+        bool dirty = false;
+        list<size_t>::iterator position;
+    };
+    filesystem::path path;
+    RegionFile file;
+    array<Slot, 1024> slots;
+    list<size_t> lru; // the cached chunks from the most recently used one
+    size_t budget, usage = 0;
+    static size_t chunkUsage(const Chunk &chunk)
+    {
+        return sizeof(Chunk) - sizeof(string) + memoryUsage(chunk.data.name) + memoryUsage(chunk.data.tag) - sizeof(Tag);
+    }
+    Slot &load(size_t i)
+    {
+        Slot &slot = slots.at(i);
+        if (slot.chunk)
+            lru.splice(lru.begin(), lru, slot.position);
+        else if (const HeaderEntry &entry = file.getHeader()[i]; entry.exists())
+        {
+            slot.chunk = make_shared<Chunk>(entry.timestamp, file.readChunkData(i));
+            slot.size = chunkUsage(*slot.chunk);
+            slot.position = lru.insert(lru.begin(), i);
+            usage += slot.size;
+            evict();
+        }
+        return slot;
+    }
+    void release(Slot &slot)
+    {
+        usage -= slot.size;
+        lru.erase(slot.position);
+        slot = {};
+    }
+    /// Evict the least recently used clean chunks until the usage is within the budget, keeping the most recently used one
+    void evict()
+    {
+        for (auto i = lru.end(); usage > budget && i != lru.begin();)
+        {
+            if (--i == lru.begin())
+                break;
+            if (Slot &slot = slots[*i]; !slot.dirty)
+            {
+                auto next = ::std::next(i);
+                release(slot);
+                i = next;
+            }
+        }
+    }
+public:
+    /// Open a region file with a budget of bytes for the decoded chunks
+    explicit LazyRegion(const filesystem::path &path, size_t budget = 64 << 20) : path(path), file(path), budget(budget) {}
+    const RegionFile &getFile() const
+    {
+        return file;
+    }
+    /// Whether a chunk exists, which doesn't decode it
+    bool exists(size_t x, size_t z) const
+    {
+        return file.getEntry(x, z).exists();
+    }
+    /// Get a chunk by its local coordinates within a region, which is decoded on first access, or nullptr if it doesn't exist
+    shared_ptr<const Chunk> get(size_t x, size_t z)
+    {
+        return load(x + 32 * z).chunk;
+    }
+    /// Get a chunk for modification, which becomes dirty and stays in memory until it is saved, or nullptr if it doesn't exist
+    shared_ptr<Chunk> modify(size_t x, size_t z)
+    {
+        Slot &slot = load(x + 32 * z);
+        slot.dirty = slot.chunk != nullptr;
+        return slot.chunk;
+    }
+    /// Write the dirty chunks to the region file, which makes them clean and remaps the file
+    void save(uint8_t compression_type = 2)
+    {
+        {
+            RegionWriter writer(path);
+            for (size_t i = 0; i < 1024; i++)
+                if (Slot &slot = slots[i]; slot.dirty)
+                    writer.writeChunk(i % 32, i / 32, slot.chunk->data, compression_type, slot.chunk->timestamp);
+        }
+        file = RegionFile(path);
+        for (Slot &slot : slots)
+            if (slot.dirty)
+            {
+                usage -= slot.size;
+                slot.size = chunkUsage(*slot.chunk);
+                usage += slot.size;
+                slot.dirty = false;
+            }
+        evict();
+    }
+    /// Evict all the clean chunks
+    void clear()
+    {
+        for (Slot &slot : slots)
+            if (slot.chunk && !slot.dirty)
+                release(slot);
+    }
+    size_t getBudget() const
+    {
+        return budget;
+    }
+    void setBudget(size_t budget)
+    {
+        this->budget = budget;
+        evict();
+    }
+    /// The estimated memory usage of the cached chunks
+    size_t getUsage() const
+    {
+        return usage;
+    }
+    /// The number of the cached chunks
+    size_t size() const
+    {
+        return lru.size();
+    }
+};
+/// The region files of a world, which maps the global coordinates of chunks to the region files `r.<rx>.<rz>.mca`
+/// The region files are opened with their headers parsed on demand and cached, closing the least recently used ones beyond a capacity
+/// A missing or empty region file is also cached as missing until `clear`, and a world is synchronized so that it can be shared by threads
+class World
+{
+    filesystem::path dir;
+    size_t capacity;
+    std::mutex mutex;
+    struct Cached
+    {
+        shared_ptr<const RegionFile> file;
+        shared_ptr<const detail::FileDescriptor> fd; // opened by the first asynchronous read of the region file
+        list<pair<int, int>>::iterator lru;
+    };
+    map<pair<int, int>, Cached> files;
+    list<pair<int, int>> lru; // the cached region files from the most recently used one
+public:
+    /// Open the region directory of a world, which is either the directory of the world or the `region` directory in it
+    explicit World(const filesystem::path &path, size_t capacity = 64) : dir(filesystem::is_directory(path / "region") ? path / "region" : path), capacity(max<size_t>(capacity, 1)) {}
+    const filesystem::path &getDirectory() const
+    {
+        return dir;
+    }
+    filesystem::path getRegionPath(int rx, int rz) const
+    {
+        return dir / ("r." + to_string(rx) + "." + to_string(rz) + ".mca");
+    }
+    /// Parse the coordinates of a region file from its name
+    static optional<pair<int, int>> parseRegionPath(const filesystem::path &path)
+    {
+        string name = path.filename().string();
+        int rx, rz;
+        const char *p = name.data(), *end = name.data() + name.size();
+        if (!name.starts_with("r.") || !name.ends_with(".mca"))
+            return nullopt;
+        auto [x_end, x_error] = from_chars(p + 2, end, rx);
+        if (x_error != errc() || *x_end != '.')
+            return nullopt;
+        auto [z_end, z_error] = from_chars(x_end + 1, end, rz);
+        if (z_error != errc() || z_end != end - 4)
+            return nullopt;
+        return pair(rx, rz);
+    }
+    /// List the coordinates of the region files of the world
+    vector<pair<int, int>> listRegions() const
+    {
+        vector<pair<int, int>> ret;
+        for (const auto &entry : filesystem::directory_iterator(dir))
+            if (auto coords = parseRegionPath(entry.path()); coords && entry.is_regular_file())
+                ret.push_back(*coords);
+        ranges::sort(ret);
+        return ret;
+    }
+    /// Get a region file by its coordinates, or nullptr if it doesn't exist or is empty
+    /// A region file is opened without holding the lock, so cold opens on different threads don't wait for each other
+    shared_ptr<const RegionFile> getRegion(int rx, int rz)
+    {
+        unique_lock lock(mutex);
+        if (auto i = files.find({rx, rz}); i != files.end())
+        {
+            lru.splice(lru.begin(), lru, i->second.lru);
+            return i->second.file;
+        }
+        lock.unlock();
+        filesystem::path path = getRegionPath(rx, rz);
+        shared_ptr<const RegionFile> file = filesystem::exists(path) && filesystem::file_size(path) != 0 ? make_shared<const RegionFile>(path) : nullptr;
+        lock.lock();
+        // another thread may have opened the same region file meanwhile
+        if (auto i = files.find({rx, rz}); i != files.end())
+        {
+            lru.splice(lru.begin(), lru, i->second.lru);
+            return i->second.file;
+        }
+        files.emplace(pair(rx, rz), Cached{file, nullptr, lru.insert(lru.begin(), {rx, rz})});
+        if (lru.size() > capacity)
+        {
+            files.erase(lru.back());
+            lru.pop_back();
+        }
+        return file;
+    }
+    /// Get a file descriptor of a region file for asynchronous reads, or nullptr if it doesn't exist or is empty
+    /// It is opened once and kept with the cached region file, so reads of its chunks share it
+    shared_ptr<const detail::FileDescriptor> getRegionDescriptor(int rx, int rz)
+    {
+        if (!getRegion(rx, rz))
+            return nullptr;
+        unique_lock lock(mutex);
+        if (auto i = files.find({rx, rz}); i != files.end() && i->second.fd)
+            return i->second.fd;
+        lock.unlock();
+        auto fd = make_shared<const detail::FileDescriptor>(getRegionPath(rx, rz));
+        lock.lock();
+        // the region file may have been evicted, or another thread may have opened it meanwhile
+        if (auto i = files.find({rx, rz}); i != files.end())
+        {
+            if (!i->second.fd)
+                i->second.fd = fd;
+            return i->second.fd;
+        }
+        return fd;
+    }
+    /// Whether a chunk exists by its global coordinates, which doesn't decode it
+    bool exists(int cx, int cz)
+    {
+        shared_ptr<const RegionFile> file = getRegion(cx >> 5, cz >> 5);
+        return file && file->getEntry(cx & 31, cz & 31).exists();
+    }
+    /// Read a chunk by its global coordinates
+    Chunk readChunk(int cx, int cz)
+    {
+        shared_ptr<const RegionFile> file = getRegion(cx >> 5, cz >> 5);
+        if (!file)
+            throw runtime_error("the region file doesn't exist");
+        return file->readChunk(cx & 31, cz & 31);
+    }
+    /// Read a chunk by its global coordinates and update statistics
+    Chunk readChunk(int cx, int cz, bin::Stats &stats)
+    {
+        shared_ptr<const RegionFile> file = getRegion(cx >> 5, cz >> 5);
+        if (!file)
+            throw runtime_error("the region file doesn't exist");
+        return file->readChunk(cx & 31, cz & 31, stats);
+    }
+    /// Close all the region files, such as after they are modified
+    void clear()
+    {
+        lock_guard lock(mutex);
+        files.clear();
+        lru.clear();
+    }
+    /// The number of the cached region files
+    size_t size()
+    {
+        lock_guard lock(mutex);
+        return lru.size();
+    }
+};
+/// The options of `forEachChunk`
+struct ForEachOptions
+{
+    size_t threads = thread::hardware_concurrency();
+    /// The bound of the compressed size of the chunks being decoded or processed at the same time, which a single chunk may exceed alone
+    size_t max_in_flight = 256 << 20;
+    /// A token for cancelling, after which no more chunks are started
+    stop_token stop;
+};
+namespace detail
+{
+/// A task of decoding a chunk, weighted by its compressed length in the chunk header
+struct ChunkTask
+{
+    uint32_t file;
+    uint32_t index;
+    size_t weight;
+};
+/// The tasks of a worker grouped by region file from the heaviest region, whose last tasks are stolen by the other workers
+struct TaskQueue
+{
+    std::mutex mutex;
+    deque<ChunkTask> tasks;
+    atomic<size_t> weight = 0;
+};
+} // namespace detail
+/// Decode the chunks of all the region files of a world and call `fn(cx, cz, chunk)` with their global coordinates in parallel, returning the number of chunks processed
+/// The chunks are enumerated from the headers and weighted by their compressed length; whole region files are dealt to the workers from the heaviest one, each to the worker with the least weight, and the chunks of a region file are queued together from the heaviest, so that a worker mostly reuses the file of its last chunk and large chunks start first; an idle worker steals single chunks from the worker with the most remaining weight
+/// The region files are opened through the cache of the world, so at most its capacity and one more for each worker are mapped at a time
+/// `fn` is called by multiple threads at the same time; an exception from it or from decoding cancels the other chunks and is rethrown
+template <typename Fn>
+    requires invocable<Fn &, int, int, Chunk &>
+size_t forEachChunk(World &world, Fn &&fn, const ForEachOptions &options = {})
+{
+    vector<pair<int, int>> coords = world.listRegions();
+    // the tasks of each region file from the heaviest chunk, and their total weight
+    vector<pair<size_t, vector<detail::ChunkTask>>> regions;
+    size_t count = 0;
+    for (size_t i = 0; i < coords.size(); i++)
+    {
+        shared_ptr<const RegionFile> file = world.getRegion(coords[i].first, coords[i].second);
+        if (!file)
+            continue;
+        pair<size_t, vector<detail::ChunkTask>> region;
+        for (size_t j = 0; j < 1024; j++)
+            if (const HeaderEntry &entry = file->getHeader()[j]; entry.exists())
+            {
+                // an invalid chunk is weighted by its sectors, and its error is reported when it is decoded
+                size_t weight;
+                try
+                {
+                    weight = file->getPayload(j).data.size() + 1;
+                }
+                catch (const exception &)
+                {
+                    weight = 0x1000 * size_t(entry.location.count);
+                }
+                region.second.push_back({static_cast<uint32_t>(i), static_cast<uint32_t>(j), weight});
+                region.first += weight;
+            }
+        if (region.second.empty())
+            continue;
+        ranges::stable_sort(region.second, greater(), &detail::ChunkTask::weight);
+        count += region.second.size();
+        regions.push_back(::std::move(region));
+    }
+    if (count == 0)
+        return 0;
+    // deal the region files from the heaviest one to the worker with the least weight
+    ranges::stable_sort(regions, greater(), [](const auto &region) { return region.first; });
+    size_t threads = clamp<size_t>(options.threads, 1, count);
+    vector<detail::TaskQueue> queues(threads);
+    for (const auto &[weight, tasks] : regions)
+    {
+        detail::TaskQueue &queue = *ranges::min_element(queues, {}, [](const detail::TaskQueue &queue) { return queue.weight.load(memory_order_relaxed); });
+        queue.tasks.insert(queue.tasks.end(), tasks.begin(), tasks.end());
+        queue.weight += weight;
+    }
+    regions = {};
+    auto next = [&queues](size_t worker) -> optional<detail::ChunkTask> {
+        auto pop = [](detail::TaskQueue &queue, bool front) -> optional<detail::ChunkTask> {
+            lock_guard lock(queue.mutex);
+            if (queue.tasks.empty())
+                return nullopt;
+            detail::ChunkTask task = front ? queue.tasks.front() : queue.tasks.back();
+            front ? queue.tasks.pop_front() : queue.tasks.pop_back();
+            queue.weight -= task.weight;
+            return task;
+        };
+        if (auto task = pop(queues[worker], true))
+            return task;
+        for (;;)
+        {
+            auto victim = ranges::max_element(queues, {}, [](const detail::TaskQueue &queue) { return queue.weight.load(); });
+            if (victim->weight == 0)
+                return nullopt;
+            if (auto task = pop(*victim, false))
+                return task;
+        }
+    };
+    atomic<size_t> processed = 0;
+    atomic<bool> failed = false;
+    exception_ptr error;
+    std::mutex mutex;
+    condition_variable_any released;
+    size_t in_flight = 0;
+    {
+        vector<jthread> workers;
+        for (size_t w = 0; w < threads; w++)
+            workers.emplace_back([&, w] {
+                // the file of the last chunk of the worker, which is kept without locking the world
+                uint32_t last = numeric_limits<uint32_t>::max();
+                shared_ptr<const RegionFile> file;
+                while (!failed && !options.stop.stop_requested())
+                {
+                    optional<detail::ChunkTask> task = next(w);
+                    if (!task)
+                        break;
+                    {
+                        unique_lock lock(mutex);
+                        if (!released.wait(lock, options.stop, [&] { return failed || in_flight == 0 || in_flight + task->weight <= options.max_in_flight; }) || failed)
+                            break;
+                        in_flight += task->weight;
+                    }
+                    try
+                    {
+                        auto [rx, rz] = coords[task->file];
+                        if (task->file != last)
+                        {
+                            file = nullptr;
+                            file = world.getRegion(rx, rz);
+                            last = task->file;
+                            if (!file)
+                                throw runtime_error("the region file doesn't exist");
+                        }
+                        Chunk chunk{file->getHeader()[task->index].timestamp, file->readChunkData(task->index)};
+                        fn(rx * 32 + static_cast<int>(task->index % 32), rz * 32 + static_cast<int>(task->index / 32), chunk);
+                        processed++;
+                    }
+                    catch (...)
+                    {
+                        lock_guard lock(mutex);
+                        if (!error)
+                            error = current_exception();
+                        failed = true;
+                    }
+                    {
+                        lock_guard lock(mutex);
+                        in_flight -= task->weight;
+                    }
+                    released.notify_all();
+                }
+            });
+    }
+    if (error)
+        rethrow_exception(error);
+    return processed;
+}
+/// A coroutine yielding values lazily, whose values are referred to by its iterator until it is resumed
+template <typename T>
+class Generator
+{
+public:
+    struct promise_type
+    {
+        T *value = nullptr;
+        exception_ptr error;
+        Generator get_return_object()
+        {
+            return Generator(coroutine_handle<promise_type>::from_promise(*this));
+        }
+        suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+        suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+        suspend_always yield_value(T &val) noexcept
+        {
+            value = addressof(val);
+            return {};
+        }
+        suspend_always yield_value(T &&val) noexcept
+        {
+            value = addressof(val);
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception()
+        {
+            error = current_exception();
+        }
+    };
+    class iterator
+    {
+        coroutine_handle<promise_type> handle;
+    public:
+        using value_type = T;
+        using difference_type = ptrdiff_t;
+        iterator() = default;
+        explicit iterator(coroutine_handle<promise_type> handle) : handle(handle) {}
+        T &operator*() const
+        {
+            return *handle.promise().value;
+        }
+        iterator &operator++()
+        {
+            handle.resume();
+            if (handle.promise().error)
+                rethrow_exception(handle.promise().error);
+            return *this;
+        }
+        void operator++(int)
+        {
+            ++*this;
+        }
+        bool operator==(default_sentinel_t) const
+        {
+            return handle.done();
+        }
+    };
+private:
+    coroutine_handle<promise_type> handle;
+    explicit Generator(coroutine_handle<promise_type> handle) : handle(handle) {}
+public:
+    Generator(Generator &&other) noexcept : handle(exchange(other.handle, nullptr)) {}
+    Generator &operator=(Generator &&other) noexcept
+    {
+        swap(handle, other.handle);
+        return *this;
+    }
+    ~Generator()
+    {
+        if (handle)
+            handle.destroy();
+    }
+    /// Run the coroutine to its first value, which can be called only once
+    iterator begin()
+    {
+        return ++iterator(handle);
+    }
+    default_sentinel_t end() const
+    {
+        return default_sentinel;
+    }
+};
+namespace detail
+{
+template <typename T>
+struct TaskResult
+{
+    optional<T> value;
+    void return_value(T val)
+    {
+        value.emplace(::std::move(val));
+    }
+    T take()
+    {
+        return ::std::move(*value);
+    }
+};
+template <>
+struct TaskResult<void>
+{
+    void return_void() {}
+    void take() {}
+};
+} // namespace detail
+/// A coroutine producing a value, which starts when it is awaited or run by an event loop, and resumes its awaiter when it finishes
+template <typename T = void>
+class Task
+{
+public:
+    struct promise_type : detail::TaskResult<T>
+    {
+        coroutine_handle<> continuation = noop_coroutine();
+        exception_ptr error;
+        Task get_return_object()
+        {
+            return Task(coroutine_handle<promise_type>::from_promise(*this));
+        }
+        suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+        auto final_suspend() noexcept
+        {
+            struct Awaiter
+            {
+                bool await_ready() noexcept
+                {
+                    return false;
+                }
+                coroutine_handle<> await_suspend(coroutine_handle<promise_type> handle) noexcept
+                {
+                    return handle.promise().continuation;
+                }
+                void await_resume() noexcept {}
+            };
+            return Awaiter{};
+        }
+        void unhandled_exception()
+        {
+            error = current_exception();
+        }
+    };
+private:
+    coroutine_handle<promise_type> handle;
+    explicit Task(coroutine_handle<promise_type> handle) : handle(handle) {}
+    friend class EventLoop;
+public:
+    Task(Task &&other) noexcept : handle(exchange(other.handle, nullptr)) {}
+    Task &operator=(Task &&other) noexcept
+    {
+        swap(handle, other.handle);
+        return *this;
+    }
+    ~Task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+    bool done() const
+    {
+        return handle.done();
+    }
+    /// Get the result of a finished task, or rethrow its exception
+    T result()
+    {
+        if (handle.promise().error)
+            rethrow_exception(handle.promise().error);
+        return handle.promise().take();
+    }
+    auto operator co_await() noexcept
+    {
+        struct Awaiter
+        {
+            Task &task;
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+            coroutine_handle<> await_suspend(coroutine_handle<> awaiter) noexcept
+            {
+                task.handle.promise().continuation = awaiter;
+                return task.handle;
+            }
+            T await_resume()
+            {
+                return task.result();
+            }
+        };
+        return Awaiter{*this};
+    }
+};
+/// A single-threaded event loop running coroutines, which keeps many reads of files in flight by io_uring on Linux, or does them by `pread` if io_uring is unavailable
+class EventLoop
+{
+    detail::ReadQueue queue;
+    deque<coroutine_handle<>> ready;
+    list<Task<>> spawned;
+public:
+    /// An awaitable read of a file into a buffer, which results in the bytes read (fewer only at the end of the file)
+    class Read
+    {
+        friend class EventLoop;
+        EventLoop &loop;
+        int fd;
+        char *buffer;
+        size_t size;
+        off_t offset;
+        ssize_t result = 0;
+        coroutine_handle<> handle;
+    public:
+        Read(EventLoop &loop, int fd, char *buffer, size_t size, off_t offset) : loop(loop), fd(fd), buffer(buffer), size(size), offset(offset) {}
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+        void await_suspend(coroutine_handle<> handle)
+        {
+            this->handle = handle;
+            loop.waiting.push_back(this);
+        }
+        size_t await_resume()
+        {
+            if (result < 0)
+                throw system_error(static_cast<int>(-result), generic_category(), "read() error");
+            return static_cast<size_t>(result);
+        }
+    };
+private:
+    deque<Read *> waiting; // the reads not submitted yet, which wait for free slots of the queue
+public:
+    /// Create an event loop with reads in flight up to a depth, using io_uring if `io_uring` is true and it is available
+    explicit EventLoop(size_t depth = 64, bool io_uring = true) : queue(depth, io_uring) {}
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+    /// Wait for the reads in flight, which write into the frames of the coroutines, before destroying the spawned coroutines
+    ~EventLoop()
+    {
+        waiting.clear();
+        ready.clear();
+        try
+        {
+            while (queue.inFlight() != 0)
+                queue.wait([](uint64_t, ssize_t) {});
+        }
+        catch (const system_error &)
+        {
+            // the reads can't be waited for, so their buffers must outlive the loop
+            for (Task<> &task : spawned)
+                task.handle = nullptr;
+            orphans.clear();
+        }
+        for (coroutine_handle<> handle : orphans)
+            handle.destroy();
+    }
+    /// Whether the reads are completed by io_uring
+    bool async() const
+    {
+        return queue.async();
+    }
+    Read read(int fd, char *buffer, size_t size, off_t offset)
+    {
+        return Read(*this, fd, buffer, size, offset);
+    }
+    /// Run a task in the background, whose exception is rethrown by `poll` or `run`
+    void spawn(Task<> task)
+    {
+        ready.push_back(task.handle);
+        spawned.push_back(::std::move(task));
+    }
+private:
+    list<coroutine_handle<>> orphans; // the tasks left by `run` while they may be waiting for reads, which are destroyed with the loop
+    // do a step of `poll`, keeping the first exception of the finished spawned tasks
+    bool step(bool block, exception_ptr &error)
+    {
+        while (!ready.empty())
+        {
+            coroutine_handle<> handle = ready.front();
+            ready.pop_front();
+            handle.resume();
+        }
+        while (!waiting.empty() && !queue.full())
+        {
+            Read *read = waiting.front();
+            waiting.pop_front();
+            queue.read(read->fd, read->buffer, read->size, read->offset, reinterpret_cast<uint64_t>(read));
+        }
+        if (queue.inFlight() != 0)
+            queue.wait([this](uint64_t user_data, ssize_t result) {
+                Read *read = reinterpret_cast<Read *>(user_data);
+                read->result = result;
+                ready.push_back(read->handle);
+            }, block && ready.empty());
+        for (auto i = spawned.begin(); i != spawned.end();)
+            if (i->done())
+            {
+                Task<> task = ::std::move(*i);
+                i = spawned.erase(i);
+                try
+                {
+                    task.result();
+                }
+                catch (...)
+                {
+                    if (!error)
+                        error = current_exception();
+                }
+            }
+            else
+                ++i;
+        return !ready.empty() || !waiting.empty() || queue.inFlight() != 0 || !spawned.empty();
+    }
+public:
+    /// Resume the ready coroutines and those whose reads have completed, waiting for a completion if `block` is true and no coroutine is ready, and return whether any work remains
+    bool poll(bool block = false)
+    {
+        exception_ptr error;
+        bool pending = step(block, error);
+        if (error)
+            rethrow_exception(error);
+        return pending;
+    }
+    /// Run until all the work is done
+    void run()
+    {
+        while (poll(true))
+            ;
+    }
+    /// Run a task until it finishes, running the other work meanwhile, and return its result
+    template <typename T>
+    T run(Task<T> task)
+    {
+        ready.push_back(task.handle);
+        // the task is run to the end before the exception of a spawned task is rethrown, and it is kept by the loop on other errors, as it may be waiting for a read
+        exception_ptr error;
+        try
+        {
+            while (!task.done())
+                if (!step(true, error) && !task.done())
+                    throw logic_error("the task is waiting for nothing");
+        }
+        catch (...)
+        {
+            if (!task.done())
+                orphans.push_back(exchange(task.handle, nullptr));
+            throw;
+        }
+        if (error)
+            rethrow_exception(error);
+        return task.result();
+    }
+};
+/// Read a chunk by its global coordinates asynchronously with an event loop, using the header cached by the world
+/// The file descriptor of the region file is cached by the world, and the chunk is decoded on the thread of the event loop after its sectors are read
+inline Task<Chunk> readChunkAsync(EventLoop &loop, World &world, int cx, int cz)
+{
+    shared_ptr<const RegionFile> file = world.getRegion(cx >> 5, cz >> 5);
+    if (!file)
+        throw runtime_error("the region file doesn't exist");
+    HeaderEntry entry = file->getEntry(cx & 31, cz & 31);
+    if (!entry.exists())
+        throw runtime_error("the chunk doesn't exist in the region file");
+    shared_ptr<const detail::FileDescriptor> fd = world.getRegionDescriptor(cx >> 5, cz >> 5);
+    if (!fd)
+        throw runtime_error("the region file doesn't exist");
+    detail::Buffer buffer;
+    size_t total = 0x1000 * size_t(entry.location.count), size = 0;
+    buffer.reserve(total);
+    // a short read before the end of the file is resubmitted for the rest of the sectors
+    while (size < total)
+    {
+        size_t n = co_await loop.read(fd->get(), buffer.data() + size, total - size, 0x1000 * off_t(entry.location.offset) + off_t(size));
+        if (n == 0)
+            break;
+        size += n;
+    }
+    uint32_t length = 0;
+    if (size >= 5)
+        memcpy(&length, buffer.data(), 4);
+    length = endianswap(length);
+    detail::checkLength(length, size);
+    co_return Chunk{entry.timestamp, detail::decode(static_cast<uint8_t>(buffer.data()[4]), span<const char>(buffer.data() + 5, length - 1))};
+}
+/// Decode the chunks of a region file lazily in the order of their sectors, yielding their indices `x + 32 * z` and the chunks
+/// The region file must outlive the generator
+inline Generator<pair<size_t, Chunk>> chunks(const RegionFile &region)
+{
+    for (size_t i : region.getSectorOrder())
+    {
+        pair<size_t, Chunk> item(i, Chunk{region.getHeader()[i].timestamp, region.readChunkData(i)});
+        co_yield item;
+    }
+}
+/// The sizes of a region file before and after compaction, and the error that left it untouched if any
+struct Compaction
+{
+    size_t before, after;
+    exception_ptr error = nullptr;
+};
+/// Rewrite a region file with its chunks packed consecutively in the order of their coordinates, leaving no free sectors
+/// The payloads are copied without decompression, and the file is replaced only after the rewritten one is complete
+/// An empty region file, which the game leaves behind, is left as it is
+inline Compaction compactRegion(const filesystem::path &path)
+{
+    filesystem::path temp = path;
+    temp += ".tmp";
+    size_t before = filesystem::file_size(path);
+    if (before == 0)
+        return {0, 0};
+    try
+    {
+        RegionFile file(path);
+        ofstream out(temp, ios::binary);
+        out.exceptions(ostream::failbit | ostream::badbit);
+        uint32_t locations[1024]{}, timestamps[1024]{};
+        static const char zeros[0x2000]{};
+        out.write(zeros, 0x2000);
+        uint32_t offset = 2;
+        for (size_t i = 0; i < 1024; i++)
+        {
+            const HeaderEntry &entry = file.getHeader()[i];
+            if (!entry.exists())
+                continue;
+            Payload payload = file.getPayload(i);
+            uint8_t count = detail::sectorCount(payload.data.size());
+            char prefix[5];
+            detail::writeChunkHeader(prefix, payload.compression_type, payload.data.size());
+            out.write(prefix, 5);
+            out.write(payload.data.data(), payload.data.size());
+            out.write(zeros, 0x1000 * size_t(count) - 5 - payload.data.size());
+            locations[i] = makeLocation({offset, count});
+            timestamps[i] = endianswap(entry.timestamp);
+            offset += count;
+        }
+        out.seekp(0);
+        out.write(reinterpret_cast<const char *>(&locations), sizeof(locations));
+        out.write(reinterpret_cast<const char *>(&timestamps), sizeof(timestamps));
+        // the errors of the last writes are reported by closing, and the file must be on disk before it replaces the original
+        out.close();
+        detail::FileDescriptor written(temp);
+        if (::fsync(written.get()) == -1)
+            throw system_error(errno, generic_category(), "fsync() error");
+    }
+    catch (...)
+    {
+        filesystem::remove(temp);
+        throw;
+    }
+    filesystem::rename(temp, path);
+    return {before, filesystem::file_size(path)};
+}
+/// Compact region files in parallel, such as the region files of a world
+/// A file that fails to be compacted is left untouched and its error is recorded in its result, without stopping the others
+inline vector<Compaction> compactRegions(const vector<filesystem::path> &files, size_t threads = thread::hardware_concurrency())
+{
+    vector<Compaction> ret(files.size());
+    atomic<size_t> next = 0;
+    {
+        vector<jthread> workers;
+        for (size_t i = 0; i < max<size_t>(threads, 1); i++)
+            workers.emplace_back([&] {
+                for (size_t i = next++; i < files.size(); i = next++)
+                    try
+                    {
+                        ret[i] = compactRegion(files[i]);
+                    }
+                    catch (...)
+                    {
+                        ret[i].error = current_exception();
+                    }
+            });
+    }
+    return ret;
+}
+#endif
+/// Extract columns from the chunks in region files in parallel, skipping empty region files
+inline void exportRegions(const vector<filesystem::path> &files, columnar::Exporter &exporter, size_t threads = thread::hardware_concurrency())
+{
+    atomic<size_t> next = 0;
+    exception_ptr error;
+    std::mutex mutex;
+    {
+        vector<jthread> workers;
+        for (size_t i = 0; i < max<size_t>(threads, 1); i++)
+            workers.emplace_back([&] {
+                try
+                {
+                    auto batch = exporter.batch();
+                    for (size_t i = next++; i < files.size(); i = next++)
+                    {
+                        // the game leaves empty region files behind
+                        if (filesystem::file_size(files[i]) == 0)
+                            continue;
+                        for (const auto &chunk : readRegion(ifstream(files[i], ios::binary)))
+                            if (chunk.has_value())
+                            {
+                                NBT_TRACE_SPAN("export");
+                                batch.add(chunk->data.tag);
+                            }
+                    }
+                    batch.flush();
+                }
+                catch (...)
+                {
+                    lock_guard lock(mutex);
+                    if (!error)
+                        error = current_exception();
+                    next = files.size();
+                }
+            });
+    }
+    if (error)
+        rethrow_exception(error);
+    exporter.finish();
 }
 } // namespace mca
 
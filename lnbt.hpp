@@ -19,17 +19,41 @@
 #ifndef _LNBT_HPP
 #define _LNBT_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <bit>
+#include <cctype>
 #include <charconv>
+#include <chrono>
 #include <concepts>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <initializer_list>
 #include <istream>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <ostream>
+#include <set>
+#include <source_location>
+#include <span>
 #include <string>
+#include <system_error>
+#include <tuple>
+#include <utility>
 #include <variant>
 #include <vector>
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace nbt
 {
@@ -66,6 +90,11 @@ template <typename T>
 constexpr bool is_vector = false;
 template <typename T>
 constexpr bool is_vector<vector<T>> = true;
+/// Check if a type is a instance of optional
+template <typename T>
+constexpr bool is_optional = false;
+template <typename T>
+constexpr bool is_optional<optional<T>> = true;
 /// Specify that a type is a valid array type
 template <typename T>
 concept is_array = same_as<T, vector<int8_t>> || same_as<T, vector<int>> || same_as<T, vector<long long>>;
@@ -74,40 +103,142 @@ concept is_array = same_as<T, vector<int8_t>> || same_as<T, vector<int>> || same
 template <typename T>
 concept is_list = is_vector<T> && is_tag<typename T::value_type>;
 
+size_t memoryUsage(const Tag &tag);
+size_t memoryUsage(const List &list);
+size_t memoryUsage(const Compound &compound);
+#if defined(LNBT_NO_IMPLICIT_COPY)
+// Tags can only be copied by `clone()`, so that accidental deep copies are compile errors
+#define LNBT_COPY_CONTROL(type, base)  \
+    type() = default;                  \
+    type(type &&) = default;           \
+    type &operator=(type &&) = default; \
+    type(const type &) = delete;       \
+    type &operator=(const type &) = delete;
+#elif defined(LNBT_COUNT_COPIES)
+namespace detail
+{
+/// Record the deep copies of tags by call site, ignoring the copies of their children
+struct CopyCounter
+{
+    struct Site
+    {
+        size_t count = 0, bytes = 0;
+    };
+    static inline thread_local size_t depth = 0;
+    static inline std::mutex mutex;
+    static inline map<tuple<string_view, uint_least32_t, string_view>, Site> sites;
+};
+template <typename T>
+struct CopyGuard
+{
+    const T &source;
+    source_location location;
+    CopyGuard(const T &source, source_location location) : source(source), location(location)
+    {
+        CopyCounter::depth++;
+    }
+    ~CopyGuard()
+    {
+        if (--CopyCounter::depth != 0)
+            return;
+        size_t bytes = memoryUsage(source);
+        lock_guard lock(CopyCounter::mutex);
+        auto &site = CopyCounter::sites[{location.file_name(), location.line(), location.function_name()}];
+        site.count++, site.bytes += bytes;
+    }
+};
+} // namespace detail
+/// The deep copies of tags at a call site
+struct CopySite
+{
+    string_view file;
+    uint_least32_t line;
+    string_view function;
+    size_t count, bytes;
+};
+/// Get the deep copies of tags by call site, sorted by bytes in descending order
+inline vector<CopySite> copySites()
+{
+    lock_guard lock(detail::CopyCounter::mutex);
+    vector<CopySite> sites;
+    for (const auto &[key, site] : detail::CopyCounter::sites)
+        sites.push_back({::std::get<0>(key), ::std::get<1>(key), ::std::get<2>(key), site.count, site.bytes});
+    sort(sites.begin(), sites.end(), [](const CopySite &a, const CopySite &b) { return a.bytes > b.bytes; });
+    return sites;
+}
+/// Clear the recorded deep copies
+inline void resetCopySites()
+{
+    lock_guard lock(detail::CopyCounter::mutex);
+    detail::CopyCounter::sites.clear();
+}
+// Count the deep copies of tags by call site
+// The assignment takes its operand by value, so a copy assignment copies through the copy constructor at the call site and is recorded there
+#define LNBT_COPY_CONTROL(type, base)                                                    \
+    type() = default;                                                                    \
+    type(type &&) = default;                                                             \
+    type(const type &other, source_location location = source_location::current()); \
+    type &operator=(type other);
+// The copies are defined after Tag is complete, since copying a Compound or a List copies the tags in it
+#define LNBT_COPY_DEFINE(type, base)                                                                                                   \
+    inline type::type(const type &other, source_location location) : base((detail::CopyGuard(other, location), static_cast<const base &>(other))) {} \
+    inline type &type::operator=(type other)                                                                                          \
+    {                                                                                                                                  \
+        base::operator=(static_cast<base &&>(other));                                                                                 \
+        return *this;                                                                                                                  \
+    }
+#else
+#define LNBT_COPY_CONTROL(type, base)
+#endif
+#ifndef LNBT_COPY_DEFINE
+#define LNBT_COPY_DEFINE(type, base)
+#endif
+
 /// A list of name-tag pairs
 struct Compound : public map<string, Tag>
 {
     using map::map;
-    Tag &get(string name)
+    LNBT_COPY_CONTROL(Compound, map)
+    /// Make a deep copy
+    Compound clone() const;
+    Tag &get(const string &name)
     {
         return at(name);
     }
-    const Tag &get(string name) const
+    const Tag &get(const string &name) const
     {
         return at(name);
     }
     template <typename T>
-    T &get(string name);
+    T &get(const string &name);
     template <typename T>
-    const T &get(string name) const;
-    Tag *get_if(string name);
-    const Tag *get_if(string name) const;
+    const T &get(const string &name) const;
+    Tag *get_if(const string &name);
+    const Tag *get_if(const string &name) const;
     template <typename T>
-    T *get_if(string name);
+    T *get_if(const string &name);
     template <typename T>
-    const T *get_if(string name) const;
+    const T *get_if(const string &name) const;
 };
 /// An ordered list of unnamed tags, all of the same type
 struct List : public variant<vector<monostate>, vector<int8_t>, vector<short>, vector<int>, vector<long long>, vector<float>, vector<double>, vector<vector<int8_t>>, vector<string>, vector<List>, vector<Compound>, vector<vector<int>>, vector<vector<long long>>>
 {
     using variant::variant;
+    LNBT_COPY_CONTROL(List, variant)
     template <is_tag T>
-    List(initializer_list<T> l) : variant(vector(l)) {}
+    List(initializer_list<T> l);
+    /// Make a deep copy
+    List clone() const;
     /// Get the type of the tags in the List
     inline TagType getType() const noexcept
     {
         return static_cast<TagType>(index());
     }
+    /// Get the number of the tags in the List
+    inline size_t size() const noexcept
+    {
+        return ::std::visit([](const auto &vec) { return vec.size(); }, *this);
+    }
     template <typename T>
     vector<T> &get()
     {
@@ -159,11 +290,14 @@ struct List : public variant<vector<monostate>, vector<int8_t>, vector<short>, v
 struct Tag : public variant<monostate, int8_t, short, int, long long, float, double, vector<int8_t>, string, List, Compound, vector<int>, vector<long long>>
 {
     using variant::variant;
+    LNBT_COPY_CONTROL(Tag, variant)
     /// Initializer-list constructor for Compound
-    Tag(initializer_list<Compound::value_type> l) : variant(Compound(l)) {}
+    Tag(initializer_list<Compound::value_type> l);
     /// Initializer-list constructor for List
     template <is_tag T>
     Tag(initializer_list<T> l) : variant(List(l)) {}
+    /// Make a deep copy
+    Tag clone() const;
     /// Get the type of the tag
     inline TagType getType() const noexcept
     {
@@ -179,21 +313,21 @@ struct Tag : public variant<monostate, int8_t, short, int, long long, float, dou
     {
         return ::std::get<T>(*this);
     }
-    Tag &get(string name)
+    Tag &get(const string &name)
     {
         return get<Compound>().at(name);
     }
-    const Tag &get(string name) const
+    const Tag &get(const string &name) const
     {
         return get<Compound>().at(name);
     }
     template <typename T>
-    T &get(string name)
+    T &get(const string &name)
     {
         return get(name).get<T>();
     }
     template <typename T>
-    const T &get(string name) const
+    const T &get(const string &name) const
     {
         return get(name).get<T>();
     }
@@ -232,21 +366,21 @@ struct Tag : public variant<monostate, int8_t, short, int, long long, float, dou
     {
         return ::std::get_if<T>(this);
     }
-    Tag *get_if(string name)
+    Tag *get_if(const string &name)
     {
         return get_if<Compound>()->get_if(name);
     }
-    const Tag *get_if(string name) const
+    const Tag *get_if(const string &name) const
     {
         return get_if<Compound>()->get_if(name);
     }
     template <typename T>
-    T *get_if(string name)
+    T *get_if(const string &name)
     {
         return get_if(name)->get_if<T>();
     }
     template <typename T>
-    const T *get_if(string name) const
+    const T *get_if(const string &name) const
     {
         return get_if(name)->get_if<T>();
     }
@@ -268,19 +402,19 @@ struct Tag : public variant<monostate, int8_t, short, int, long long, float, dou
     }
 };
 template <typename T>
-T &Compound::get(string name)
+T &Compound::get(const string &name)
 {
     return get(name).get<T>();
 }
 template <typename T>
-const T &Compound::get(string name) const
+const T &Compound::get(const string &name) const
 {
     return get(name).get<T>();
 }
 // Comparing 'this' pointer with nullptr is necessary here
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wtautological-undefined-compare"
-inline Tag *Compound::get_if(string name)
+inline Tag *Compound::get_if(const string &name)
 {
     if (this == nullptr)
         return nullptr;
@@ -289,7 +423,7 @@ inline Tag *Compound::get_if(string name)
         return nullptr;
     return &(iter->second);
 }
-inline const Tag *Compound::get_if(string name) const
+inline const Tag *Compound::get_if(const string &name) const
 {
     if (this == nullptr)
         return nullptr;
@@ -300,12 +434,12 @@ inline const Tag *Compound::get_if(string name) const
 }
 #pragma clang diagnostic pop
 template <typename T>
-T *Compound::get_if(string name)
+T *Compound::get_if(const string &name)
 {
     return get_if(name)->get_if<T>();
 }
 template <typename T>
-const T *Compound::get_if(string name) const
+const T *Compound::get_if(const string &name) const
 {
     return get_if(name)->get_if<T>();
 }
@@ -315,10 +449,30 @@ struct NBT
     string name;
     Tag tag;
     NBT() = default;
-    NBT(string name, Tag tag) : name(name), tag(tag) {}
-    NBT(Tag tag) : name(), tag(tag) {}
-    NBT(pair<string, Tag> p) : name(p.first), tag(p.second) {}
+    NBT(string name, Tag tag) : name(::std::move(name)), tag(::std::move(tag)) {}
+    NBT(Tag tag) : name(), tag(::std::move(tag)) {}
+    NBT(pair<string, Tag> p) : name(::std::move(p.first)), tag(::std::move(p.second)) {}
+    /// Make a deep copy
+    NBT clone() const
+    {
+        return NBT(name, tag.clone());
+    }
 };
+/// Get the type ID of a tag type at compile time
+template <is_tag T>
+constexpr TagType tagTypeOf = same_as<T, monostate>         ? TagType::End
+                              : same_as<T, int8_t>            ? TagType::Byte
+                              : same_as<T, short>             ? TagType::Short
+                              : same_as<T, int>               ? TagType::Int
+                              : same_as<T, long long>         ? TagType::Long
+                              : same_as<T, float>             ? TagType::Float
+                              : same_as<T, double>            ? TagType::Double
+                              : same_as<T, vector<int8_t>>    ? TagType::ByteArray
+                              : same_as<T, string>            ? TagType::String
+                              : same_as<T, List>              ? TagType::List
+                              : same_as<T, Compound>          ? TagType::Compound
+                              : same_as<T, vector<int>>       ? TagType::IntArray
+                                                              : TagType::LongArray;
 /// Match a tag type to the corresponding C++ type through explicitly specifying template arguments of a lambda expressions with an explicit template parameter list
 template <typename Func>
 auto match(TagType type, Func &&func)
@@ -341,8 +495,481 @@ auto match(TagType type, Func &&func)
     default: throw runtime_error("unsupported tag ID");
     } // clang-format on
 }
+LNBT_COPY_DEFINE(Compound, map)
+LNBT_COPY_DEFINE(List, variant)
+LNBT_COPY_DEFINE(Tag, variant)
+inline Compound Compound::clone() const
+{
+    Compound compound;
+    for (const auto &[name, tag] : *this)
+        compound.emplace_hint(compound.end(), name, tag.clone());
+    return compound;
+}
+inline List List::clone() const
+{
+    return match(getType(), [this]<typename T> -> List {
+        if constexpr (same_as<T, List> || same_as<T, Compound>)
+        {
+            vector<T> vec;
+            vec.reserve(get<T>().size());
+            for (const auto &e : get<T>())
+                vec.push_back(e.clone());
+            return vec;
+        }
+        else
+            return vector<T>(get<T>());
+    });
+}
+inline Tag Tag::clone() const
+{
+    return match(getType(), [this]<typename T> -> Tag {
+        if constexpr (same_as<T, List> || same_as<T, Compound>)
+            return get<T>().clone();
+        else
+            return T(get<T>());
+    });
+}
+template <is_tag T>
+List::List(initializer_list<T> l)
+{
+    if constexpr (same_as<T, List> || same_as<T, Compound>)
+    {
+        vector<T> vec;
+        vec.reserve(l.size());
+        for (const auto &e : l)
+            vec.push_back(e.clone());
+        emplace<vector<T>>(::std::move(vec));
+    }
+    else
+        emplace<vector<T>>(l);
+}
+inline Tag::Tag(initializer_list<Compound::value_type> l)
+{
+    Compound compound;
+    for (const auto &[name, tag] : l)
+        compound.emplace(name, tag.clone());
+    emplace<Compound>(::std::move(compound));
+}
+/// Estimate the memory used by a string, including its heap memory unless it is stored inline by the small string optimization
+inline size_t memoryUsage(const string &str)
+{
+    // the capacity of an empty string is the largest one stored inline by the standard library
+    static const size_t inline_capacity = string().capacity();
+    return sizeof(string) + (str.capacity() > inline_capacity ? str.capacity() + 1 : 0);
+}
+/// Estimate the memory used by a tag tree, including the heap memory of its children
+inline size_t memoryUsage(const Tag &tag)
+{
+    return match(tag.getType(), [&tag]<typename T> {
+        const T &val = tag.get<T>();
+        if constexpr (same_as<T, string>)
+            return sizeof(Tag) - sizeof(string) + memoryUsage(val);
+        else if constexpr (is_array<T>)
+            return sizeof(Tag) + val.capacity() * sizeof(typename T::value_type);
+        else if constexpr (same_as<T, List> || same_as<T, Compound>)
+            return sizeof(Tag) - sizeof(T) + memoryUsage(val);
+        else
+            return sizeof(Tag);
+    });
+}
+/// Estimate the memory used by a List, including the heap memory of its children
+inline size_t memoryUsage(const List &list)
+{
+    return match(list.getType(), [&list]<typename T> {
+        const vector<T> &vec = list.get<T>();
+        size_t size = sizeof(List) + vec.capacity() * sizeof(T);
+        if constexpr (same_as<T, string>)
+            for (const auto &e : vec)
+                size += memoryUsage(e) - sizeof(string);
+        else if constexpr (is_vector<T>)
+            for (const auto &e : vec)
+                size += e.capacity() * sizeof(typename T::value_type);
+        else if constexpr (same_as<T, List> || same_as<T, Compound>)
+            for (const auto &e : vec)
+                size += memoryUsage(e) - sizeof(T);
+        return size;
+    });
+}
+/// Estimate the memory used by a Compound, including the heap memory of its children
+inline size_t memoryUsage(const Compound &compound)
+{
+    // each node of the red-black tree has a color and three pointers besides the value
+    size_t size = sizeof(Compound);
+    for (const auto &[name, tag] : compound)
+        size += 4 * sizeof(void *) + memoryUsage(name) + memoryUsage(tag);
+    return size;
+}
+/// The action returned by a visitor of `walk` to control the traversal
+enum class Walk
+{
+    /// Visit the children of the tag, if any
+    Continue,
+    /// Don't visit the children of the tag
+    Skip,
+    /// Stop the traversal
+    Stop
+};
+/// The path from the root tag to a tag, each element of which is either a name in a Compound or an index in a List
+/// Note: names refer to the keys of the tree being walked, so they are valid as long as the tree is not modified
+struct Path : public vector<variant<string_view, size_t>>
+{
+    /// Convert the path to a string like `Level.Sections[0].Y`
+    string toString() const
+    {
+        string str;
+        for (const auto &e : *this)
+        {
+            if (const string_view *name = ::std::get_if<string_view>(&e))
+            {
+                if (!str.empty())
+                    str.push_back('.');
+                str.append(*name);
+            }
+            else
+                str.append("[").append(to_string(::std::get<size_t>(e))).append("]");
+        }
+        return str;
+    }
+};
+namespace detail
+{
+/// Walk a tag tree iteratively with an explicit stack
+template <bool is_const, typename Visitor>
+class Walker
+{
+    template <typename T>
+    using qualified = conditional_t<is_const, const T, T>;
+    using CompoundIterator = conditional_t<is_const, Compound::const_iterator, Compound::iterator>;
+    struct CompoundFrame
+    {
+        CompoundIterator iter, end;
+    };
+    template <typename T>
+    struct ListFrame
+    {
+        qualified<vector<T>> *vec;
+        size_t i;
+    };
+    Visitor &visitor;
+    Path path;
+    vector<variant<CompoundFrame, ListFrame<List>, ListFrame<Compound>>> stack;
+    /// Call the visitor if it accepts the type, and push a frame if the children should be visited
+    template <typename T>
+    bool visit(qualified<T> &val)
+    {
+        Walk action = Walk::Continue;
+        const Path &cpath = path;
+        if constexpr (invocable<Visitor &, const Path &, qualified<T> &>)
+        {
+            if constexpr (same_as<invoke_result_t<Visitor &, const Path &, qualified<T> &>, void>)
+                visitor(cpath, val);
+            else
+                action = visitor(cpath, val);
+        }
+        if (action != Walk::Continue)
+            return action != Walk::Stop;
+        if constexpr (same_as<T, Compound>)
+            stack.push_back(CompoundFrame{val.begin(), val.end()});
+        else if constexpr (same_as<T, List>)
+            return match(val.getType(), [this, &val]<typename U> {
+                auto &vec = val.template get<U>();
+                if constexpr (same_as<U, List> || same_as<U, Compound>)
+                    stack.push_back(ListFrame<U>{&vec, 0});
+                else
+                    for (size_t i = 0; i < vec.size(); i++)
+                    {
+                        path.push_back(i);
+                        if (!visit<U>(vec[i]))
+                            return false;
+                        path.pop_back();
+                    }
+                return true;
+            });
+        return true;
+    }
+    bool visit(qualified<Tag> &tag)
+    {
+        return match(tag.getType(), [this, &tag]<typename T> { return visit<T>(tag.template get<T>()); });
+    }
+    /// Visit a child of the top frame, keeping its path element only if a frame is pushed for it
+    template <typename T>
+    bool visitChild(T &child)
+    {
+        size_t depth = stack.size();
+        bool ret;
+        if constexpr (same_as<remove_const_t<T>, Tag>)
+            ret = visit(child);
+        else
+            ret = visit<remove_const_t<T>>(child);
+        if (ret && stack.size() == depth)
+            path.pop_back();
+        return ret;
+    }
+public:
+    Walker(Visitor &visitor) : visitor(visitor) {}
+    void walk(qualified<Tag> &root)
+    {
+        if (!visit(root))
+            return;
+        while (!stack.empty())
+        {
+            bool ret = ::std::visit(
+                [this](auto &frame) {
+                    if constexpr (same_as<remove_cvref_t<decltype(frame)>, CompoundFrame>)
+                    {
+                        if (frame.iter == frame.end)
+                            return leave();
+                        auto &[name, tag] = *frame.iter++;
+                        path.push_back(string_view(name));
+                        return visitChild(tag);
+                    }
+                    else
+                    {
+                        if (frame.i == frame.vec->size())
+                            return leave();
+                        size_t i = frame.i++;
+                        path.push_back(i);
+                        return visitChild((*frame.vec)[i]);
+                    }
+                },
+                stack.back());
+            if (!ret)
+                return;
+        }
+    }
+    /// Pop the top frame and its path element
+    bool leave()
+    {
+        stack.pop_back();
+        if (!stack.empty())
+            path.pop_back();
+        return true;
+    }
+};
+} // namespace detail
+/// Walk a tag tree in depth-first order without recursion
+/// The visitor is called as `visitor(path, value)` for every tag whose type it accepts, where `value` is the tag as its C++ type, and the elements of a List are visited as their C++ types as well. It may return `Walk` to skip the children of a tag or stop the traversal, or return `void` to always continue.
+template <typename T, typename Visitor>
+    requires same_as<remove_const_t<T>, Tag>
+void walk(T &tag, Visitor &&visitor)
+{
+    detail::Walker<is_const_v<T>, remove_reference_t<Visitor>>(visitor).walk(tag);
+}
+/// Describe the fields of a struct bound to a Compound, which is specialized by `NBT_FIELDS`
+/// A specialization may also provide `dispatch<endian>(in, type, name, val)` to read a field by name faster, and `extra` as the member pointer to a Compound that keeps unknown tags, which are used by the code generated by `nbt::schema::generate`
+template <typename T>
+struct fields;
+/// Specify that a type is bound to a Compound by `NBT_FIELDS`
+template <typename T>
+concept is_bound = requires { fields<T>::forEach([](string_view, auto) { return false; }); };
 } // namespace nbt
 
+// Helper macros for applying a macro to each of the arguments
+#define NBT_PARENS ()
+#define NBT_EXPAND(...) NBT_EXPAND4(NBT_EXPAND4(NBT_EXPAND4(NBT_EXPAND4(__VA_ARGS__))))
+#define NBT_EXPAND4(...) NBT_EXPAND3(NBT_EXPAND3(NBT_EXPAND3(NBT_EXPAND3(__VA_ARGS__))))
+#define NBT_EXPAND3(...) NBT_EXPAND2(NBT_EXPAND2(NBT_EXPAND2(NBT_EXPAND2(__VA_ARGS__))))
+#define NBT_EXPAND2(...) NBT_EXPAND1(NBT_EXPAND1(NBT_EXPAND1(NBT_EXPAND1(__VA_ARGS__))))
+#define NBT_EXPAND1(...) __VA_ARGS__
+#define NBT_FOR_EACH(macro, type, ...) __VA_OPT__(NBT_EXPAND(NBT_FOR_EACH_HELPER(macro, type, __VA_ARGS__)))
+#define NBT_FOR_EACH_HELPER(macro, type, a, ...) macro(type, a) __VA_OPT__(NBT_FOR_EACH_AGAIN NBT_PARENS(macro, type, __VA_ARGS__))
+#define NBT_FOR_EACH_AGAIN() NBT_FOR_EACH_HELPER
+#define NBT_FIELD(type, field) func(#field, &type::field) ||
+/// Bind the fields of a struct to the tags with the same names in a Compound, which must be used in the global namespace
+/// e.g. `NBT_FIELDS(Player, Pos, Health, Inventory)`
+/// It generates `nbt::fields<type>::forEach(func)`, which calls `func(name, member_pointer)` for each field until it returns true
+#define NBT_FIELDS(type, ...)                                        \
+    template <>                                                      \
+    struct nbt::fields<type>                                         \
+    {                                                                \
+        template <typename Func>                                     \
+        static constexpr bool forEach(Func &&func)                   \
+        {                                                            \
+            return NBT_FOR_EACH(NBT_FIELD, type, __VA_ARGS__) false; \
+        }                                                            \
+    };
+
+namespace nbt::trace
+{
+/// A span of time spent in a phase by a thread, in nanoseconds of `steady_clock`
+struct Event
+{
+    const char *name;
+    long long begin, end;
+};
+/// A ring buffer of the latest events of a thread, which is written only by the thread without locks
+class Buffer
+{
+public:
+    static constexpr size_t capacity = 1 << 16;
+    /// The ID and the name of the thread
+    size_t id;
+    string name;
+    Buffer(size_t id) : id(id), name("thread " + to_string(id)) {}
+    void push(const Event &event)
+    {
+        size_t i = head.load(memory_order_relaxed);
+        Event &slot = events[i % capacity];
+        atomic_ref(slot.name).store(event.name, memory_order_relaxed);
+        atomic_ref(slot.begin).store(event.begin, memory_order_relaxed);
+        atomic_ref(slot.end).store(event.end, memory_order_relaxed);
+        head.store(i + 1, memory_order_release);
+    }
+    /// Call a function for each event that has not been overwritten, from the oldest to the latest
+    template <typename Func>
+    void forEach(Func &&func) const
+    {
+        size_t end = head.load(memory_order_acquire);
+        size_t begin = end > capacity ? end - capacity : 0;
+        vector<Event> copy;
+        copy.reserve(end - begin);
+        // the fields are copied atomically while the thread may overwrite them, and the torn events are dropped below
+        for (size_t i = begin; i < end; i++)
+        {
+            Event &slot = events[i % capacity];
+            copy.push_back({atomic_ref(slot.name).load(memory_order_relaxed), atomic_ref(slot.begin).load(memory_order_relaxed), atomic_ref(slot.end).load(memory_order_relaxed)});
+        }
+        atomic_thread_fence(memory_order_acquire);
+        // the events pushed during the copy may have overwritten the oldest ones, and the event being pushed (at `now`) overwrites one more
+        size_t now = head.load(memory_order_relaxed);
+        for (size_t i = max(begin, now + 1 > capacity ? now + 1 - capacity : 0); i < end; i++)
+            func(copy[i - begin]);
+    }
+    /// Drop all the events, which must not be called when the thread may push events
+    void clear()
+    {
+        head.store(0, memory_order_relaxed);
+    }
+private:
+    atomic<size_t> head = 0;
+    unique_ptr<Event[]> events = make_unique<Event[]>(capacity);
+};
+namespace detail
+{
+/// The buffers of all the threads that have recorded events, which outlive their threads
+struct Registry
+{
+    std::mutex mutex;
+    vector<shared_ptr<Buffer>> buffers;
+    atomic<bool> enabled = true;
+};
+inline Registry &registry()
+{
+    static Registry registry;
+    return registry;
+}
+inline Buffer &buffer()
+{
+    thread_local shared_ptr<Buffer> buffer = [] {
+        Registry &registry = detail::registry();
+        lock_guard lock(registry.mutex);
+        return registry.buffers.emplace_back(make_shared<Buffer>(registry.buffers.size()));
+    }();
+    return *buffer;
+}
+inline long long now()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+} // namespace detail
+/// Record the time from its construction to its destruction as an event of the current thread
+/// The name must outlive the exporting of events, such as a string literal
+class Span
+{
+public:
+    explicit Span(const char *name) : name(name), begin(detail::registry().enabled.load(memory_order_relaxed) ? detail::now() : -1) {}
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+    ~Span()
+    {
+        if (begin >= 0)
+            detail::buffer().push({name, begin, detail::now()});
+    }
+private:
+    const char *name;
+    long long begin;
+};
+/// Start or stop recording events, which is started by default
+inline void start()
+{
+    detail::registry().enabled = true;
+}
+inline void stop()
+{
+    detail::registry().enabled = false;
+}
+/// Name the current thread in the exported trace
+inline void setThreadName(string name)
+{
+    Buffer &buffer = detail::buffer();
+    lock_guard lock(detail::registry().mutex);
+    buffer.name = ::std::move(name);
+}
+/// Drop the recorded events, which must not be called when other threads may record events
+inline void clear()
+{
+    detail::Registry &registry = detail::registry();
+    lock_guard lock(registry.mutex);
+    for (const auto &buffer : registry.buffers)
+        buffer->clear();
+}
+/// Write the recorded events as Chrome trace JSON, which can be opened by `chrome://tracing` or Perfetto
+inline void write(ostream &out)
+{
+    auto writeString = [&out](string_view s) {
+        out.put('"');
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+                out.put('\\');
+            if (static_cast<unsigned char>(c) >= 0x20)
+                out.put(c);
+        }
+        out.put('"');
+    };
+    auto writeMicroseconds = [&out](long long ns) {
+        out << ns / 1000 << '.' << static_cast<char>('0' + ns / 100 % 10) << static_cast<char>('0' + ns / 10 % 10) << static_cast<char>('0' + ns % 10);
+    };
+    detail::Registry &registry = detail::registry();
+    lock_guard lock(registry.mutex);
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    for (const auto &buffer : registry.buffers)
+    {
+        out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id << ",\"args\":{\"name\":";
+        writeString(buffer->name);
+        out << "}}";
+        first = false;
+        buffer->forEach([&](const Event &event) {
+            out << ",\n{\"name\":";
+            writeString(event.name);
+            out << ",\"cat\":\"lnbt\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id
+                << ",\"ts\":";
+            writeMicroseconds(event.begin);
+            out << ",\"dur\":";
+            writeMicroseconds(event.end - event.begin);
+            out << "}";
+        });
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+/// Write the recorded events as Chrome trace JSON
+inline void write(ostream &&out)
+{
+    write(out);
+}
+} // namespace nbt::trace
+
+// Helper macros for making a unique variable name
+#define NBT_CONCAT(a, b) NBT_CONCAT_HELPER(a, b)
+#define NBT_CONCAT_HELPER(a, b) a##b
+/// Record the rest of the current scope as a span named `name` when `LNBT_TRACE` is defined, or do nothing otherwise
+#ifdef LNBT_TRACE
+#define NBT_TRACE_SPAN(name) ::nbt::trace::Span NBT_CONCAT(nbt_trace_span_, __LINE__)(name)
+#else
+#define NBT_TRACE_SPAN(name)
+#endif
+
 namespace nbt::bin
 {
 /// A helper function for changing the endian of a value to endian::native
@@ -366,12 +993,135 @@ inline T endianswap(T val)
             static_assert(false, "not a supported type");
     }
 }
+/// Statistics collected while reading NBT, which are useful for understanding the throughput of parsing
+struct Stats
+{
+    /// The size of a chunk in a region file before and after decompression
+    struct ChunkSize
+    {
+        size_t compressed, uncompressed;
+    };
+    /// Bytes of NBT consumed (after decompression)
+    size_t bytes = 0;
+    /// The number of tags read, indexed by their type IDs (including the root tag and the elements of Lists)
+    array<size_t, 13> tags{};
+    /// The maximum nesting depth of Compounds and Lists
+    size_t max_depth = 0;
+    /// The number and the total size of the heap allocations needed by the tag trees read (an estimate based on the standard library's layout)
+    size_t allocations = 0, allocated_bytes = 0;
+    /// Time spent in decompressing and in parsing
+    chrono::nanoseconds inflate_time{}, parse_time{};
+    /// The number of the chunks read from region files and their total size before and after decompression
+    size_t chunk_count = 0, compressed_bytes = 0, uncompressed_bytes = 0;
+    /// Whether to record the size of each chunk in `chunks`, which grows by an entry per chunk without bound
+    bool record_chunks = false;
+    /// The sizes of the chunks read from region files, if `record_chunks` is true
+    vector<ChunkSize> chunks;
+    /// Count a chunk read from a region file
+    void addChunk(size_t compressed, size_t uncompressed)
+    {
+        chunk_count++, compressed_bytes += compressed, uncompressed_bytes += uncompressed;
+        if (record_chunks)
+            chunks.push_back({compressed, uncompressed});
+    }
+    /// Merge the statistics collected by another thread
+    void merge(const Stats &other)
+    {
+        bytes += other.bytes;
+        for (size_t i = 0; i < tags.size(); i++)
+            tags[i] += other.tags[i];
+        max_depth = max(max_depth, other.max_depth);
+        allocations += other.allocations, allocated_bytes += other.allocated_bytes;
+        inflate_time += other.inflate_time, parse_time += other.parse_time;
+        chunk_count += other.chunk_count, compressed_bytes += other.compressed_bytes, uncompressed_bytes += other.uncompressed_bytes;
+        chunks.insert(chunks.end(), other.chunks.begin(), other.chunks.end());
+    }
+    /// Count the tags, the depth and the allocations of a tag tree in the same way as the binary reader
+    void count(const Tag &tag)
+    {
+        walk(tag, [this](const Path &path, const auto &val) {
+            using T = remove_cvref_t<decltype(val)>;
+            tags[static_cast<size_t>(tagTypeOf<T>)]++;
+            auto allocate = [this](size_t size) { allocations++, allocated_bytes += size; };
+            if constexpr (same_as<T, string>)
+            {
+                if (val.size() > string().capacity())
+                    allocate(val.size() + 1);
+            }
+            else if constexpr (is_array<T>)
+            {
+                if (!val.empty())
+                    allocate(val.size() * sizeof(typename T::value_type));
+            }
+            else if constexpr (same_as<T, List> || same_as<T, Compound>)
+            {
+                max_depth = max(max_depth, path.size() + 1);
+                if constexpr (same_as<T, List>)
+                    match(val.getType(), [&val, &allocate]<typename U> {
+                        if (!val.template get<U>().empty())
+                            allocate(val.template get<U>().size() * sizeof(U));
+                    });
+                else
+                    for (const auto &[name, tag] : val)
+                    {
+                        if (name.size() > string().capacity())
+                            allocate(name.size() + 1);
+                        allocate(sizeof(Compound::value_type) + 4 * sizeof(void *)); // a node of the red-black tree
+                    }
+            }
+        });
+    }
+    /// Write a human-readable summary
+    void report(ostream &out) const
+    {
+        static constexpr const char *names[] = {"end", "byte", "short", "int", "long", "float", "double", "byte_array", "string", "list", "compound", "int_array", "long_array"};
+        auto ms = [](chrono::nanoseconds t) { return chrono::duration<double, milli>(t).count(); };
+        out << "bytes: " << bytes << "\n";
+        for (size_t i = 0; i < tags.size(); i++)
+            if (tags[i] != 0)
+                out << "tags." << names[i] << ": " << tags[i] << "\n";
+        out << "max_depth: " << max_depth << "\n"
+            << "allocations: " << allocations << " (" << allocated_bytes << " bytes)\n"
+            << "inflate_time: " << ms(inflate_time) << " ms\n"
+            << "parse_time: " << ms(parse_time) << " ms\n";
+        if (parse_time.count() > 0)
+            out << "parse_throughput: " << bytes / ms(parse_time) / 1000 << " MB/s\n";
+        if (chunk_count != 0)
+            out << "chunks: " << chunk_count << " (" << compressed_bytes << " bytes compressed, " << uncompressed_bytes << " bytes uncompressed)\n";
+    }
+};
+/// The default statistics parameter of readers, which disables all hooks
+struct NoStats
+{
+};
 /// A helper class for making binary io support both big endian and little endian
 /// Instead of using the functions in this class directly, use nbt::read and nbt::write
-template <endian endian>
+template <endian endian, typename Stats = NoStats>
 class io
 {
 protected:
+    /// Whether statistics are collected, which are updated by the hooks in the functions below
+    static constexpr bool collect = !same_as<Stats, NoStats>;
+    /// The statistics collected by the current thread and the current depth of Compounds and Lists
+    static inline thread_local Stats *stats = nullptr;
+    static inline thread_local size_t depth = 0;
+    /// Hooks for entering and leaving a Compound or a List
+    static void enter()
+    {
+        if constexpr (collect)
+            stats->max_depth = max(stats->max_depth, ++depth);
+    }
+    static void leave()
+    {
+        if constexpr (collect)
+            depth--;
+    }
+    /// Hook for a heap allocation of a tag tree
+    static void allocate(size_t bytes)
+    {
+        if constexpr (collect)
+            stats->allocations++, stats->allocated_bytes += bytes;
+    }
     template <typename T>
         requires same_as<T, monostate>
     static T read(istream &in);
@@ -397,6 +1147,9 @@ protected:
     static T read(istream &in, TagType type);
 public:
     static NBT read(istream &in);
+    /// Read NBT and update statistics
+    static NBT read(istream &in, Stats &stats)
+        requires collect;
 protected:
     template <typename T>
         requires same_as<T, monostate>
@@ -424,136 +1177,186 @@ protected:
 public:
     static void write(ostream &out, const NBT &val);
 };
-template <endian endian>
+template <endian endian, typename Stats>
 template <typename T>
     requires same_as<T, monostate>
-T io<endian>::read(istream &in)
+T io<endian, Stats>::read(istream &in)
 {
     return monostate();
 }
-template <endian endian>
+template <endian endian, typename Stats>
 template <typename T>
     requires same_as<T, TagType>
-T io<endian>::read(istream &in)
+T io<endian, Stats>::read(istream &in)
 {
+    if constexpr (collect)
+        stats->bytes++;
     return static_cast<TagType>(in.get());
 }
-template <endian endian>
+template <endian endian, typename Stats>
 template <typename T>
     requires integral<T> || floating_point<T>
-T io<endian>::read(istream &in)
+T io<endian, Stats>::read(istream &in)
 {
     T val;
     in.read(reinterpret_cast<char *>(&val), sizeof(T));
+    if constexpr (collect)
+        stats->bytes += sizeof(T);
     return endianswap<endian>(val);
 }
-template <endian endian>
+template <endian endian, typename Stats>
 template <typename T>
     requires same_as<T, string>
-T io<endian>::read(istream &in)
+T io<endian, Stats>::read(istream &in)
 {
     size_t size = read<short>(in);
     string str(size, '\0');
     in.read(str.data(), size);
+    if constexpr (collect)
+    {
+        stats->bytes += size;
+        if (size > string().capacity()) // longer than the small string buffer
+            allocate(size + 1);
+    }
     return str;
 }
-template <endian endian>
+template <endian endian, typename Stats>
 template <is_list T>
-T io<endian>::read(istream &in)
-{
-    T vec(read<int>(in));
+T io<endian, Stats>::read(istream &in)
+{
+    int size = read<int>(in);
+    if (size < 0)
+        throw runtime_error("negative length");
+    T vec(size);
+    if constexpr (collect)
+        if (!vec.empty())
+            allocate(vec.size() * sizeof(typename T::value_type));
     for (auto &e : vec)
         e = read<typename T::value_type>(in);
     return vec;
 }
-template <endian endian>
+template <endian endian, typename Stats>
 template <typename T>
     requires same_as<T, List>
-T io<endian>::read(istream &in)
-{
-    return match(read<TagType>(in), [&in]<typename U> { return T(read<vector<U>>(in)); });
+T io<endian, Stats>::read(istream &in)
+{
+    enter();
+    T list = match(read<TagType>(in), [&in]<typename U> {
+        vector<U> vec = read<vector<U>>(in);
+        if constexpr (collect)
+            stats->tags[static_cast<size_t>(tagTypeOf<U>)] += vec.size();
+        return T(::std::move(vec));
+    });
+    leave();
+    return list;
 }
-template <endian endian>
+template <endian endian, typename Stats>
 template <typename T>
     requires same_as<T, Compound>
-T io<endian>::read(istream &in)
+T io<endian, Stats>::read(istream &in)
 {
+    enter();
     Compound compound;
     for (TagType type = read<TagType>(in); type != TagType::End; type = read<TagType>(in))
     {
         string name = read<string>(in);
         Tag tag = read<Tag>(in, type);
-        compound.insert(make_pair(name, tag));
-        // compound[name] = tag;
+        compound.emplace(::std::move(name), ::std::move(tag));
+        allocate(sizeof(Compound::value_type) + 4 * sizeof(void *)); // a node of the red-black tree
     }
+    leave();
     return compound;
 }
-template <endian endian>
+template <endian endian, typename Stats>
 template <typename T>
     requires same_as<T, Tag>
-T io<endian>::read(istream &in, TagType type)
+T io<endian, Stats>::read(istream &in, TagType type)
 {
-    return match(type, [&in]<typename U> { return T(read<U>(in)); });
+    return match(type, [&in]<typename U> {
+        if constexpr (collect)
+            stats->tags[static_cast<size_t>(tagTypeOf<U>)]++;
+        return T(read<U>(in));
+    });
 }
-template <endian endian>
-NBT io<endian>::read(istream &in)
+template <endian endian, typename Stats>
+NBT io<endian, Stats>::read(istream &in)
 {
     TagType type = read<TagType>(in);
     string name = read<string>(in);
     Tag tag = read<Tag>(in, type);
-    return NBT(name, tag);
+    return NBT(::std::move(name), ::std::move(tag));
+}
+template <endian endian, typename Stats>
+NBT io<endian, Stats>::read(istream &in, Stats &stats)
+    requires collect
+{
+    Stats *outer = exchange(io::stats, &stats);
+    size_t outer_depth = exchange(depth, 0);
+    auto begin = chrono::steady_clock::now();
+    try
+    {
+        NBT nbt = read(in);
+        stats.parse_time += chrono::steady_clock::now() - begin;
+        io::stats = outer, depth = outer_depth;
+        return nbt;
+    }
+    catch (...)
+    {
+        io::stats = outer, depth = outer_depth;
+        throw;
+    }
 }
 
-template <endian endian>
+template <endian endian, typename Stats>
 template <typename T>
     requires same_as<T, monostate>
-void io<endian>::write(ostream &out, T val)
+void io<endian, Stats>::write(ostream &out, T val)
 {
     return;
 }
-template <endian endian>
+template <endian endian, typename Stats>
 template <typename T>
     requires same_as<T, TagType>
-void io<endian>::write(ostream &out, T val)
+void io<endian, Stats>::write(ostream &out, T val)
 {
     out.put(static_cast<int8_t>(val));
 }
-template <endian endian>
+template <endian endian, typename Stats>
 template <typename T>
     requires integral<T> || floating_point<T>
-void io<endian>::write(ostream &out, T val)
+void io<endian, Stats>::write(ostream &out, T val)
 {
     val = endianswap<endian>(val);
     out.write(reinterpret_cast<const char *>(&val), sizeof(T));
 }
-template <endian endian>
+template <endian endian, typename Stats>
 template <typename T>
     requires same_as<T, string>
-void io<endian>::write(ostream &out, const T &val)
+void io<endian, Stats>::write(ostream &out, const T &val)
 {
     write<short>(out, val.size());
     out.write(val.c_str(), val.size());
 }
-template <endian endian>
+template <endian endian, typename Stats>
 template <is_list T>
-void io<endian>::write(ostream &out, const T &val)
+void io<endian, Stats>::write(ostream &out, const T &val)
 {
     write<int>(out, val.size());
     for (auto &e : val)
         write<typename T::value_type>(out, e);
 }
-template <endian endian>
+template <endian endian, typename Stats>
 template <typename T>
     requires same_as<T, List>
-void io<endian>::write(ostream &out, const T &val)
+void io<endian, Stats>::write(ostream &out, const T &val)
 {
     write<TagType>(out, val.getType());
     match(val.getType(), [&out, &val]<typename U> { write(out, val.template get<U>()); });
 }
-template <endian endian>
+template <endian endian, typename Stats>
 template <typename T>
     requires same_as<T, Compound>
-void io<endian>::write(ostream &out, const T &val)
+void io<endian, Stats>::write(ostream &out, const T &val)
 {
     for (const auto &[name, tag] : val)
     {
@@ -563,25 +1366,216 @@ void io<endian>::write(ostream &out, const T &val)
     }
     write<TagType>(out, TagType::End);
 }
-template <endian endian>
+template <endian endian, typename Stats>
 template <typename T>
     requires same_as<T, Tag>
-void io<endian>::write(ostream &out, const T &val)
+void io<endian, Stats>::write(ostream &out, const T &val)
 {
     match(val.getType(), [&out, &val]<typename U> { write(out, val.template get<U>()); });
 }
-template <endian endian>
-void io<endian>::write(ostream &out, const NBT &val)
+template <endian endian, typename Stats>
+void io<endian, Stats>::write(ostream &out, const NBT &val)
 {
     write<TagType>(out, val.tag.getType());
     write(out, val.name);
     write(out, val.tag);
 }
 
+/// Hash a name with a seed (FNV-1a with the finalizer of MurmurHash3 to mix the low bits), which is used for dispatching keys by perfect hashing at compile time
+constexpr uint32_t hashName(string_view name, uint32_t seed)
+{
+    uint32_t hash = 2166136261U ^ seed;
+    for (char c : name)
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619U;
+    hash = (hash ^ hash >> 16) * 0x85EBCA6BU;
+    hash = (hash ^ hash >> 13) * 0xC2B2AE35U;
+    return hash ^ hash >> 16;
+}
+/// A helper class for reading and writing the types bound by `NBT_FIELDS` directly, without constructing tags
+/// Instead of using the functions in this class directly, use nbt::bin::read<T> and nbt::bin::write
+template <endian endian>
+class binding : protected io<endian>
+{
+    using base = io<endian>;
+public:
+    /// Get the type ID of the tag that a C++ type is bound to
+    template <typename T>
+    static consteval TagType typeOf()
+    {
+        if constexpr (is_tag<T>)
+            return tagTypeOf<T>;
+        else if constexpr (same_as<T, Tag>)
+            return TagType::End; // unknown until read
+        else if constexpr (same_as<T, bool>)
+            return TagType::Byte;
+        else if constexpr (is_bound<T>)
+            return TagType::Compound;
+        else if constexpr (is_vector<T>)
+            return TagType::List;
+        else if constexpr (is_optional<T>)
+            return typeOf<typename T::value_type>();
+        else
+            static_assert(false, "not a bindable type");
+    }
+    /// Read a name into a buffer, which may be reused to avoid allocations
+    static void readName(istream &in, string &name)
+    {
+        name.resize(static_cast<unsigned short>(base::template read<short>(in)));
+        in.read(name.data(), name.size());
+    }
+    /// Write a name
+    static void writeName(ostream &out, string_view name)
+    {
+        base::template write<short>(out, name.size());
+        out.write(name.data(), name.size());
+    }
+    /// Skip the payload of a tag
+    static void skip(istream &in, TagType type)
+    {
+        match(type, [&in]<typename T> {
+            if constexpr (integral<T> || floating_point<T>)
+                in.ignore(sizeof(T));
+            else if constexpr (same_as<T, string>)
+                in.ignore(static_cast<unsigned short>(base::template read<short>(in)));
+            else if constexpr (is_array<T>)
+            {
+                int size = base::template read<int>(in);
+                if (size < 0)
+                    throw runtime_error("negative length");
+                in.ignore(static_cast<streamsize>(size) * sizeof(typename T::value_type));
+            }
+            else if constexpr (same_as<T, List>)
+            {
+                TagType type = base::template read<TagType>(in);
+                int size = base::template read<int>(in);
+                if (size < 0)
+                    throw runtime_error("negative length");
+                for (int i = 0; i < size; i++)
+                    skip(in, type);
+            }
+            else if constexpr (same_as<T, Compound>)
+                for (TagType type = base::template read<TagType>(in); type != TagType::End; type = base::template read<TagType>(in))
+                {
+                    in.ignore(static_cast<unsigned short>(base::template read<short>(in)));
+                    skip(in, type);
+                }
+        });
+    }
+    /// Read the payload of a tag with the provided type into a value
+    template <typename T>
+    static void read(istream &in, TagType type, T &val)
+    {
+        if constexpr (same_as<T, Tag>)
+            val = base::template read<Tag>(in, type);
+        else if constexpr (is_optional<T>)
+            read(in, type, val.emplace());
+        else
+        {
+            if (type != typeOf<T>())
+                throw runtime_error("unexpected tag type");
+            if constexpr (is_tag<T>)
+                val = base::template read<T>(in);
+            else if constexpr (same_as<T, bool>)
+                val = base::template read<int8_t>(in) != 0;
+            else if constexpr (is_bound<T>)
+            {
+                string name;
+                for (TagType type = base::template read<TagType>(in); type != TagType::End; type = base::template read<TagType>(in))
+                {
+                    readName(in, name);
+                    bool found;
+                    if constexpr (requires { fields<T>::template dispatch<endian>(in, type, string_view(name), val); })
+                        found = fields<T>::template dispatch<endian>(in, type, string_view(name), val);
+                    else
+                        found = fields<T>::forEach([&in, &val, &name, type](string_view field, auto member) {
+                            if (field != name)
+                                return false;
+                            read(in, type, val.*member);
+                            return true;
+                        });
+                    if (found)
+                        continue;
+                    if constexpr (requires { fields<T>::extra; })
+                        read(in, type, (val.*fields<T>::extra)[name]);
+                    else
+                        skip(in, type);
+                }
+            }
+            else if constexpr (is_vector<T>)
+            {
+                TagType type = base::template read<TagType>(in);
+                int size = base::template read<int>(in);
+                if (size < 0)
+                    throw runtime_error("negative length");
+                val.clear();
+                val.resize(size);
+                for (auto &e : val)
+                    read(in, type, e);
+            }
+        }
+    }
+    /// Write the payload of a value
+    template <typename T>
+    static void write(ostream &out, const T &val)
+    {
+        if constexpr (is_tag<T> || same_as<T, Tag>)
+            base::write(out, val);
+        else if constexpr (same_as<T, bool>)
+            base::template write<int8_t>(out, val);
+        else if constexpr (is_optional<T>)
+            write(out, *val);
+        else if constexpr (is_bound<T>)
+        {
+            fields<T>::forEach([&out, &val](string_view name, auto member) {
+                const auto &field = val.*member;
+                if constexpr (is_optional<remove_cvref_t<decltype(field)>>)
+                    if (!field.has_value())
+                        return false;
+                writeTypeOf(out, field);
+                writeName(out, name);
+                write(out, field);
+                return false;
+            });
+            if constexpr (requires { fields<T>::extra; })
+                for (const auto &[name, tag] : val.*fields<T>::extra)
+                {
+                    writeTypeOf(out, tag);
+                    writeName(out, name);
+                    write(out, tag);
+                }
+            base::template write<TagType>(out, TagType::End);
+        }
+        else if constexpr (is_vector<T>)
+        {
+            if (val.empty())
+                base::template write<TagType>(out, TagType::End);
+            else
+                writeTypeOf(out, val.front());
+            base::template write<int>(out, val.size());
+            for (const auto &e : val)
+                write(out, e);
+        }
+        else
+            static_assert(false, "not a bindable type");
+    }
+    /// Write the type ID of the tag that a value is bound to
+    template <typename T>
+    static void writeTypeOf(ostream &out, const T &val)
+    {
+        if constexpr (same_as<T, Tag>)
+            base::template write<TagType>(out, val.getType());
+        else if constexpr (is_optional<T>)
+            writeTypeOf(out, *val);
+        else
+            base::template write<TagType>(out, typeOf<T>());
+    }
+};
+
 /// Read NBT from a binary input stream
 template <endian endian = endian::big>
 inline NBT read(istream &in)
 {
+    NBT_TRACE_SPAN("parse");
     in.exceptions(istream::eofbit | istream::failbit | istream::badbit);
     return io<endian>::read(in);
 }
@@ -591,6 +1585,20 @@ inline NBT read(istream &&in)
 {
     return read<endian>(in);
 }
+/// Read NBT from a binary input stream and update statistics
+template <endian endian = endian::big>
+inline NBT read(istream &in, Stats &stats)
+{
+    NBT_TRACE_SPAN("parse");
+    in.exceptions(istream::eofbit | istream::failbit | istream::badbit);
+    return io<endian, Stats>::read(in, stats);
+}
+/// Read NBT from a binary input stream and update statistics
+template <endian endian = endian::big>
+inline NBT read(istream &&in, Stats &stats)
+{
+    return read<endian>(in, stats);
+}
 /// Write NBT to a binary output stream
 template <endian endian = endian::big>
 inline void write(ostream &out, const NBT &val)
@@ -604,12 +1612,45 @@ inline void write(ostream &&out, const NBT &val)
 {
     write<endian>(out, val);
 }
-} // namespace nbt::bin
-
-namespace nbt::str
-{
-/// The functions in this namespace have some checks removed to improve performance, so never use these functions and use the functions in the nbt::str namespace instead.
-namespace detail
+/// Read a type bound by `NBT_FIELDS` from a binary input stream directly, ignoring the name of the root tag
+template <is_bound T, endian endian = endian::big>
+inline T read(istream &in)
+{
+    in.exceptions(istream::eofbit | istream::failbit | istream::badbit);
+    TagType type = static_cast<TagType>(in.get());
+    string name;
+    binding<endian>::readName(in, name);
+    T val{};
+    binding<endian>::read(in, type, val);
+    return val;
+}
+/// Read a type bound by `NBT_FIELDS` from a binary input stream directly, ignoring the name of the root tag
+template <is_bound T, endian endian = endian::big>
+inline T read(istream &&in)
+{
+    return read<T, endian>(in);
+}
+/// Write a type bound by `NBT_FIELDS` to a binary output stream directly
+template <endian endian = endian::big, is_bound T>
+inline void write(ostream &out, const T &val, string_view name = "")
+{
+    out.exceptions(ostream::eofbit | ostream::failbit | ostream::badbit);
+    out.put(static_cast<char>(TagType::Compound));
+    binding<endian>::writeName(out, name);
+    binding<endian>::write(out, val);
+}
+/// Write a type bound by `NBT_FIELDS` to a binary output stream directly
+template <endian endian = endian::big, is_bound T>
+inline void write(ostream &&out, const T &val, string_view name = "")
+{
+    write<endian>(out, val, name);
+}
+} // namespace nbt::bin
+
+namespace nbt::str
+{
+/// The functions in this namespace have some checks removed to improve performance, so never use these functions and use the functions in the nbt::str namespace instead.
+namespace detail
 {
 inline void skipWhitespace(istream &in)
 {
@@ -749,7 +1790,7 @@ T read(istream &in)
             expect(in, ':');
             skipWhitespace(in);
             Tag tag = read<Tag>(in);
-            compound.insert(make_pair(name, tag));
+            compound.emplace(::std::move(name), ::std::move(tag));
             skipWhitespace(in);
             if (in.peek() == '}')
                 break;
@@ -792,7 +1833,7 @@ vector<T> readList(istream &in, vector<T> vec)
         expect(in, ',');
         skipWhitespace(in);
         Tag tag = read<Tag>(in);
-        vec.push_back(tag.get<T>());
+        vec.push_back(::std::move(tag.get<T>()));
     }
 }
 inline Tag readListOrArray(istream &in)
@@ -818,7 +1859,11 @@ inline Tag readListOrArray(istream &in)
         return vector<monostate>();
     }
     Tag tag = read<Tag>(in);
-    return match(tag.getType(), [&in, &tag]<typename U> { return List(readList(in, vector{tag.get<U>()})); });
+    return match(tag.getType(), [&in, &tag]<typename U> {
+        vector<U> vec;
+        vec.push_back(::std::move(tag.get<U>()));
+        return List(readList(in, ::std::move(vec)));
+    });
 }
 template <typename T>
     requires same_as<T, Tag>
@@ -923,6 +1968,7 @@ inline T read(istream &&in)
 /// Read SNBT from an input stream
 inline Tag read(istream &in)
 {
+    NBT_TRACE_SPAN("parse snbt");
     return read<Tag>(in);
 }
 /// Read SNBT from an input stream
@@ -930,6 +1976,24 @@ inline Tag read(istream &&in)
 {
     return read(in);
 }
+/// Read SNBT from an input stream and update statistics
+/// Note: the tags, the depth and the allocations are counted after parsing, and bytes are counted only if the stream supports `tellg`
+inline Tag read(istream &in, bin::Stats &stats)
+{
+    istream::pos_type begin_pos = in.tellg();
+    auto begin = chrono::steady_clock::now();
+    Tag tag = read(in);
+    stats.parse_time += chrono::steady_clock::now() - begin;
+    if (istream::pos_type end_pos = in.tellg(); begin_pos != -1 && end_pos != -1)
+        stats.bytes += end_pos - begin_pos;
+    stats.count(tag);
+    return tag;
+}
+/// Read SNBT from an input stream and update statistics
+inline Tag read(istream &&in, bin::Stats &stats)
+{
+    return read(in, stats);
+}
 
 /// Write SNBT and configure the format
 struct Writer
@@ -1198,4 +2262,1603 @@ const Writer noLineFeedWriter{.line_feed = false};
 const Writer compactWriter{.line_feed = false, .space = false};
 } // namespace nbt::str
 
+namespace nbt::schema
+{
+/// A schema that describes the expected shape of a tag
+struct Schema
+{
+    /// The expected type of the tag, where `TagType::End` matches any type
+    TagType type = TagType::End;
+    /// Whether the tag must be present in its parent Compound
+    bool required = true;
+    /// The inclusive range of a number, or of the length of a string, an array or a List
+    optional<double> min, max;
+    /// The schema of the elements of an array or a List
+    shared_ptr<const Schema> element;
+    /// The schemas of the tags in a Compound
+    map<string, Schema> keys;
+    /// Whether the tags in a Compound that are not in `keys` are rejected
+    bool strict = false;
+};
+/// The names of the types in the SNBT form of a schema, indexed by type ID
+inline constexpr string_view typeNames[] = {"any", "byte", "short", "int", "long", "float", "double", "byte_array", "string", "list", "compound", "int_array", "long_array"};
+/// Convert a tag like `{type: "compound", keys: {Health: {type: "float", min: 0, max: 20}, Name: {type: "string", optional: true}}}` to a schema
+inline Schema fromTag(const Tag &tag)
+{
+    const Compound &compound = tag.get<Compound>();
+    Schema schema;
+    if (const string *type = compound.get_if<string>("type"))
+    {
+        auto iter = find(begin(typeNames), end(typeNames), *type);
+        if (iter == end(typeNames))
+            throw runtime_error("unknown type name");
+        schema.type = static_cast<TagType>(iter - begin(typeNames));
+    }
+    if (const Tag *optional = compound.get_if("optional"))
+        schema.required = optional->get_num_as<int8_t>() == 0;
+    if (const Tag *min = compound.get_if("min"))
+        schema.min = min->get_num_as<double>();
+    if (const Tag *max = compound.get_if("max"))
+        schema.max = max->get_num_as<double>();
+    if (const Tag *element = compound.get_if("element"))
+        schema.element = make_shared<const Schema>(fromTag(*element));
+    if (const Compound *keys = compound.get_if<Compound>("keys"))
+        for (const auto &[name, key] : *keys)
+            schema.keys.emplace(name, fromTag(key));
+    if (const Tag *strict = compound.get_if("strict"))
+        schema.strict = strict->get_num_as<int8_t>() != 0;
+    return schema;
+}
+/// Convert a schema to a tag, which is the reverse of `fromTag`
+inline Tag toTag(const Schema &schema)
+{
+    Compound compound;
+    compound.emplace("type", string(typeNames[static_cast<size_t>(schema.type)]));
+    if (!schema.required)
+        compound.emplace("optional", int8_t(1));
+    if (schema.min.has_value())
+        compound.emplace("min", *schema.min);
+    if (schema.max.has_value())
+        compound.emplace("max", *schema.max);
+    if (schema.element)
+        compound.emplace("element", toTag(*schema.element));
+    if (!schema.keys.empty())
+    {
+        Compound keys;
+        for (const auto &[name, key] : schema.keys)
+            keys.emplace(name, toTag(key));
+        compound.emplace("keys", move(keys));
+    }
+    if (schema.strict)
+        compound.emplace("strict", int8_t(1));
+    return compound;
+}
+/// Read a schema from SNBT
+inline Schema read(istream &in)
+{
+    return fromTag(str::read(in));
+}
+/// Read a schema from SNBT
+inline Schema read(istream &&in)
+{
+    return read(in);
+}
+/// The reason why a tag doesn't match a schema
+struct Error
+{
+    const char *message = nullptr;
+    /// The name of the tag in a Compound that caused the error, if any
+    string_view key;
+};
+/// A validation plan compiled from a schema, which validates a tag or binary NBT in one pass without allocations
+class Validator
+{
+    static constexpr uint32_t none = -1;
+    struct Node
+    {
+        TagType type;
+        double min, max;
+        uint32_t element;
+        /// The range of the keys of a Compound in `keys`, sorted by name
+        uint32_t keys_begin, keys_end;
+        uint32_t required;
+        bool strict;
+    };
+    struct Key
+    {
+        string name;
+        uint32_t node;
+        bool required;
+    };
+    vector<Node> nodes;
+    vector<Key> keys;
+    /// The number of the 64-bit words of a bitset with a bit for each key in `keys`
+    size_t key_words = 0;
+    uint32_t compile(const Schema &schema)
+    {
+        uint32_t i = nodes.size();
+        nodes.push_back({schema.type, schema.min.value_or(-numeric_limits<double>::infinity()), schema.max.value_or(numeric_limits<double>::infinity()), none, 0, 0, 0, schema.strict});
+        uint32_t keys_begin = keys.size();
+        for (const auto &[name, key] : schema.keys)
+        {
+            keys.push_back({name, none, key.required});
+            nodes[i].required += key.required;
+        }
+        nodes[i].keys_begin = keys_begin, nodes[i].keys_end = keys.size();
+        uint32_t k = keys_begin;
+        for (const auto &[name, key] : schema.keys)
+        {
+            uint32_t node = compile(key);
+            keys[k++].node = node;
+        }
+        if (schema.element)
+        {
+            uint32_t element = compile(*schema.element);
+            nodes[i].element = element;
+        }
+        return i;
+    }
+    static bool fail(Error *error, const char *message, string_view key = {})
+    {
+        if (error != nullptr)
+            *error = {message, key};
+        return false;
+    }
+    /// Record the name of the innermost tag in a Compound that caused an error
+    static bool locate(Error *error, string_view key)
+    {
+        if (error != nullptr && error->key.empty())
+            error->key = key;
+        return false;
+    }
+    bool checkRange(const Node &node, double val, Error *error) const
+    {
+        return (val >= node.min && val <= node.max) || fail(error, "value out of range");
+    }
+    /// Find a key of a Compound by binary search
+    const Key *findKey(const Node &node, string_view name) const
+    {
+        auto first = keys.begin() + node.keys_begin, last = keys.begin() + node.keys_end;
+        auto iter = lower_bound(first, last, name, [](const Key &key, string_view name) { return key.name < name; });
+        return iter != last && iter->name == name ? &*iter : nullptr;
+    }
+    bool check(uint32_t n, const Tag &tag, Error *error) const
+    {
+        const Node &node = nodes[n];
+        if (node.type == TagType::End)
+            return true;
+        if (tag.getType() != node.type)
+            return fail(error, "unexpected tag type");
+        return match(node.type, [this, &node, &tag, error]<typename T> { return check(node, tag.get<T>(), error); });
+    }
+    template <typename T>
+    bool check(const Node &node, const T &val, Error *error) const
+    {
+        if constexpr (integral<T> || floating_point<T>)
+            return checkRange(node, val, error);
+        else if constexpr (same_as<T, string>)
+            return checkRange(node, val.size(), error);
+        else if constexpr (is_array<T>)
+        {
+            if (!checkRange(node, val.size(), error))
+                return false;
+            if (node.element != none && nodes[node.element].type != TagType::End)
+            {
+                if (nodes[node.element].type != tagTypeOf<typename T::value_type>)
+                    return fail(error, "unexpected tag type");
+                for (auto e : val)
+                    if (!checkRange(nodes[node.element], e, error))
+                        return false;
+            }
+            return true;
+        }
+        else if constexpr (same_as<T, List>)
+        {
+            if (!checkRange(node, val.size(), error))
+                return false;
+            if (node.element == none || nodes[node.element].type == TagType::End || val.size() == 0)
+                return true;
+            const Node &element = nodes[node.element];
+            if (val.getType() != element.type)
+                return fail(error, "unexpected tag type");
+            return match(element.type, [this, &element, &val, error]<typename U> {
+                for (const auto &e : val.template get<U>())
+                    if (!check(element, e, error))
+                        return false;
+                return true;
+            });
+        }
+        else if constexpr (same_as<T, Compound>)
+        {
+            uint32_t k = node.keys_begin;
+            for (const auto &[name, tag] : val)
+            {
+                for (; k < node.keys_end && keys[k].name < name; k++)
+                    if (keys[k].required)
+                        return fail(error, "required tag not found", keys[k].name);
+                if (k < node.keys_end && keys[k].name == name)
+                {
+                    if (!check(keys[k++].node, tag, error))
+                        return locate(error, name);
+                }
+                else if (node.strict)
+                    return fail(error, "unknown tag", name);
+            }
+            for (; k < node.keys_end; k++)
+                if (keys[k].required)
+                    return fail(error, "required tag not found", keys[k].name);
+            return true;
+        }
+        else
+            return true;
+    }
+    /// A cursor over binary NBT
+    template <endian endian>
+    struct Reader
+    {
+        const char *ptr, *end;
+        /// The keys seen in the Compounds being validated, a bit for each key in `keys`
+        uint64_t *seen;
+        template <typename T>
+        bool read(T &val)
+        {
+            if (end - ptr < static_cast<ptrdiff_t>(sizeof(T)))
+                return false;
+            memcpy(&val, ptr, sizeof(T));
+            val = bin::endianswap<endian>(val);
+            ptr += sizeof(T);
+            return true;
+        }
+        bool read(string_view &str)
+        {
+            uint16_t size;
+            if (!read(size) || end - ptr < size)
+                return false;
+            str = string_view(ptr, size);
+            ptr += size;
+            return true;
+        }
+        bool skip(size_t size)
+        {
+            if (static_cast<size_t>(end - ptr) < size)
+                return false;
+            ptr += size;
+            return true;
+        }
+    };
+    template <endian endian>
+    bool check(uint32_t n, TagType type, Reader<endian> &in, Error *error) const
+    {
+        if (static_cast<uint8_t>(type) > static_cast<uint8_t>(TagType::LongArray))
+            return fail(error, "unsupported tag ID");
+        const Node *node = n == none || nodes[n].type == TagType::End ? nullptr : &nodes[n];
+        if (node != nullptr && type != node->type)
+            return fail(error, "unexpected tag type");
+        constexpr const char *eof = "unexpected end of data", *negative = "negative length";
+        return match(type, [this, node, &in, error, eof, negative]<typename T> {
+            if constexpr (integral<T> || floating_point<T>)
+            {
+                T val;
+                return in.read(val) ? node == nullptr || checkRange(*node, val, error) : fail(error, eof);
+            }
+            else if constexpr (same_as<T, string>)
+            {
+                string_view val;
+                return in.read(val) ? node == nullptr || checkRange(*node, val.size(), error) : fail(error, eof);
+            }
+            else if constexpr (is_array<T>)
+            {
+                int32_t size;
+                if (!in.read(size))
+                    return fail(error, eof);
+                if (size < 0)
+                    return fail(error, negative);
+                if (node != nullptr && !checkRange(*node, size, error))
+                    return false;
+                if (node == nullptr || node->element == none || nodes[node->element].type == TagType::End)
+                    return in.skip(size * sizeof(typename T::value_type)) || fail(error, eof);
+                if (nodes[node->element].type != tagTypeOf<typename T::value_type>)
+                    return fail(error, "unexpected tag type");
+                for (int32_t i = 0; i < size; i++)
+                {
+                    typename T::value_type e;
+                    if (!in.read(e))
+                        return fail(error, eof);
+                    if (!checkRange(nodes[node->element], e, error))
+                        return false;
+                }
+                return true;
+            }
+            else if constexpr (same_as<T, List>)
+            {
+                int8_t element_type;
+                int32_t size;
+                if (!in.read(element_type) || !in.read(size))
+                    return fail(error, eof);
+                if (size < 0)
+                    return fail(error, negative);
+                if (node != nullptr && !checkRange(*node, size, error))
+                    return false;
+                uint32_t element = node == nullptr ? none : node->element;
+                // the elements of a List of End have no payload, so checking one of them checks them all
+                if (static_cast<TagType>(element_type) == TagType::End)
+                    return size == 0 || check(element, TagType::End, in, error);
+                for (int32_t i = 0; i < size; i++)
+                    if (!check(element, static_cast<TagType>(element_type), in, error))
+                        return false;
+                return true;
+            }
+            else if constexpr (same_as<T, Compound>)
+            {
+                // the keys that have been seen, so a repeated key is counted once; the keys of a Compound schema have their own bits, and a schema can't be nested in itself
+                uint64_t *seen = in.seen;
+                if (node != nullptr)
+                    for (uint32_t k = node->keys_begin; k < node->keys_end; k++)
+                        seen[k / 64] &= ~(uint64_t(1) << k % 64);
+                uint32_t required = 0;
+                for (;;)
+                {
+                    int8_t type;
+                    string_view name;
+                    if (!in.read(type))
+                        return fail(error, eof);
+                    if (static_cast<TagType>(type) == TagType::End)
+                        break;
+                    if (!in.read(name))
+                        return fail(error, eof);
+                    const Key *key = node == nullptr ? nullptr : findKey(*node, name);
+                    if (key != nullptr)
+                    {
+                        uint32_t k = key - keys.data();
+                        if (!(seen[k / 64] >> k % 64 & 1))
+                            required += key->required;
+                        seen[k / 64] |= uint64_t(1) << k % 64;
+                    }
+                    else if (node != nullptr && node->strict)
+                        return fail(error, "unknown tag", name);
+                    if (!check(key == nullptr ? none : key->node, static_cast<TagType>(type), in, error))
+                        return locate(error, name);
+                }
+                if (node != nullptr && required != node->required)
+                    for (uint32_t k = node->keys_begin; k < node->keys_end; k++)
+                        if (keys[k].required && !(seen[k / 64] >> k % 64 & 1))
+                            return fail(error, "required tag not found", keys[k].name);
+                return true;
+            }
+            else
+                return true;
+        });
+    }
+public:
+    Validator(const Schema &schema)
+    {
+        compile(schema);
+        key_words = (keys.size() + 63) / 64;
+    }
+    /// Validate a tag
+    bool validate(const Tag &tag, Error *error = nullptr) const
+    {
+        return check(0, tag, error);
+    }
+    /// Validate binary NBT, including the type and the name of the root tag
+    template <endian endian = endian::big>
+    bool validate(const char *data, size_t size, Error *error = nullptr) const
+    {
+        // the bitset of the seen keys is sized by the plan and reused by the thread, so it is only allocated when the thread first validates with a larger plan
+        thread_local vector<uint64_t> seen;
+        if (seen.size() < key_words)
+            seen.resize(key_words);
+        Reader<endian> in{data, data + size, seen.data()};
+        int8_t type;
+        string_view name;
+        if (!in.read(type) || !in.read(name))
+            return fail(error, "unexpected end of data");
+        return check(0, static_cast<TagType>(type), in, error);
+    }
+};
+/// The statistics of the tags at a path in a group of documents
+struct Observation
+{
+    /// The number of the tags of each type
+    array<size_t, 13> types{};
+    /// The number of the documents containing the path
+    size_t documents = 0;
+    /// The range of numbers
+    double min = numeric_limits<double>::infinity(), max = -numeric_limits<double>::infinity();
+    /// The range of the lengths of strings, arrays and Lists
+    size_t min_size = numeric_limits<size_t>::max(), max_size = 0;
+    /// The observations of the tags in Compounds
+    map<string, Observation> keys;
+    /// The observation of the elements of Lists
+    unique_ptr<Observation> element;
+    /// The last document containing the path, for counting documents
+    size_t last = 0;
+    /// Get the total number of the tags
+    size_t count() const
+    {
+        size_t count = 0;
+        for (size_t n : types)
+            count += n;
+        return count;
+    }
+    /// Merge another observation of a disjoint group of documents into this one
+    void merge(Observation &&other)
+    {
+        for (size_t i = 0; i < types.size(); i++)
+            types[i] += other.types[i];
+        documents += other.documents;
+        min = ::std::min(min, other.min), max = ::std::max(max, other.max);
+        min_size = ::std::min(min_size, other.min_size), max_size = ::std::max(max_size, other.max_size);
+        for (auto &[name, key] : other.keys)
+            keys[name].merge(move(key));
+        if (other.element)
+        {
+            if (element)
+                element->merge(move(*other.element));
+            else
+                element = move(other.element);
+        }
+    }
+};
+/// Infer a merged schema from a group of documents
+/// To infer in parallel, use an Inference for each thread and merge them
+class Inference
+{
+    template <typename T>
+    void add(Observation &observation, const T &val)
+    {
+        if (observation.last != documents)
+            observation.last = documents, observation.documents++;
+        observation.types[static_cast<size_t>(tagTypeOf<T>)]++;
+        if constexpr (integral<T> || floating_point<T>)
+        {
+            observation.min = ::std::min(observation.min, static_cast<double>(val));
+            observation.max = ::std::max(observation.max, static_cast<double>(val));
+        }
+        if constexpr (same_as<T, string> || is_array<T> || same_as<T, List>)
+        {
+            observation.min_size = ::std::min(observation.min_size, val.size());
+            observation.max_size = ::std::max(observation.max_size, val.size());
+        }
+        if constexpr (same_as<T, Compound>)
+            for (const auto &[name, tag] : val)
+                add(observation.keys[name], tag);
+        else if constexpr (same_as<T, List>)
+        {
+            if (val.size() == 0)
+                return;
+            if (!observation.element)
+                observation.element = make_unique<Observation>();
+            match(val.getType(), [this, &observation, &val]<typename U> {
+                for (const auto &e : val.template get<U>())
+                    add(*observation.element, e);
+            });
+        }
+    }
+    void add(Observation &observation, const Tag &tag)
+    {
+        match(tag.getType(), [this, &observation, &tag]<typename T> { add(observation, tag.get<T>()); });
+    }
+    static Schema toSchema(const Observation &observation, size_t parent)
+    {
+        Schema schema;
+        if (observation.count() != 0)
+            for (size_t i = 0; i < observation.types.size(); i++)
+                if (observation.types[i] == observation.count())
+                    schema.type = static_cast<TagType>(i);
+        schema.required = observation.count() == parent;
+        // the range of a schema is of the numbers or of the lengths by its type, and a tag of mixed types has neither
+        match(schema.type, [&schema, &observation]<typename T> {
+            if constexpr (integral<T> || floating_point<T>)
+            {
+                if (observation.min <= observation.max)
+                    schema.min = observation.min, schema.max = observation.max;
+            }
+            else if constexpr (same_as<T, string> || same_as<T, List> || is_array<T>)
+            {
+                if (observation.min_size <= observation.max_size)
+                    schema.min = static_cast<double>(observation.min_size), schema.max = static_cast<double>(observation.max_size);
+            }
+        });
+        if (observation.element)
+            schema.element = make_shared<const Schema>(toSchema(*observation.element, observation.element->count()));
+        for (const auto &[name, key] : observation.keys)
+            schema.keys.emplace(name, toSchema(key, observation.types[static_cast<size_t>(TagType::Compound)]));
+        return schema;
+    }
+    void report(ostream &out, const Observation &observation, string &path) const
+    {
+        out << (path.empty() ? "(root)" : path) << ':';
+        for (size_t i = 0; i < observation.types.size(); i++)
+            if (observation.types[i] != 0)
+                out << ' ' << typeNames[i] << " (" << observation.types[i] << ')';
+        out << ", in " << observation.documents * 100.0 / documents << "% of documents";
+        if (observation.min <= observation.max)
+            out << ", range [" << observation.min << ", " << observation.max << ']';
+        if (observation.min_size <= observation.max_size)
+            out << ", length [" << observation.min_size << ", " << observation.max_size << ']';
+        out << '\n';
+        size_t size = path.size();
+        for (const auto &[name, key] : observation.keys)
+        {
+            if (!path.empty())
+                path.push_back('.');
+            report(out, key, path.append(name));
+            path.resize(size);
+        }
+        if (observation.element)
+        {
+            report(out, *observation.element, path.append("[]"));
+            path.resize(size);
+        }
+    }
+public:
+    /// The number of the documents
+    size_t documents = 0;
+    /// The observation of the root tags
+    Observation root;
+    /// Add a document
+    void add(const Tag &tag)
+    {
+        documents++;
+        add(root, tag);
+    }
+    /// Merge another inference of a disjoint group of documents into this one
+    void merge(Inference &&other)
+    {
+        documents += other.documents;
+        root.merge(move(other.root));
+    }
+    /// Infer a schema, where a tag is required only if it is present in all its parents, and the type is `any` if there are multiple types
+    Schema toSchema() const
+    {
+        return toSchema(root, root.count());
+    }
+    /// Write the observation of each path, like `Level.Sections[].Y: byte (1024), in 100% of documents, range [-4, 19]`
+    void report(ostream &out) const
+    {
+        string path;
+        report(out, root, path);
+    }
+};
+namespace detail
+{
+/// Generate the C++ code of the structs of a schema and the specializations of `nbt::fields` for them
+class Generator
+{
+    ostream &out;
+    set<string> structs;
+    /// Convert a name to a valid C++ identifier
+    static string identifier(string_view name)
+    {
+        // the keywords of C++23 and the alternative tokens, sorted for binary search
+        static constexpr string_view keywords[] = {"alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break", "case", "catch", "char", "char16_t", "char32_t", "char8_t", "class", "co_await", "co_return", "co_yield", "compl", "concept", "const", "const_cast", "consteval", "constexpr", "constinit", "continue", "decltype", "default", "delete", "do", "double", "dynamic_cast", "else", "enum", "explicit", "export", "extern", "false", "float", "for", "friend", "goto", "if", "inline", "int", "long", "mutable", "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator", "or", "or_eq", "private", "protected", "public", "register", "reinterpret_cast", "requires", "return", "short", "signed", "sizeof", "static", "static_assert", "static_cast", "struct", "switch", "template", "this", "thread_local", "throw", "true", "try", "typedef", "typeid", "typename", "union", "unsigned", "using", "virtual", "void", "volatile", "wchar_t", "while", "xor", "xor_eq"};
+        string id;
+        for (char c : name)
+            id.push_back(isalnum(static_cast<unsigned char>(c)) ? c : '_');
+        if (id.empty() || isdigit(static_cast<unsigned char>(id.front())) || binary_search(begin(keywords), end(keywords), id))
+            id.insert(id.begin(), '_');
+        return id;
+    }
+    /// Quote a name as a C++ string literal
+    static string literal(string_view name)
+    {
+        string str = "\"";
+        for (char c : name)
+        {
+            if (c == '\"' || c == '\\')
+                str.push_back('\\'), str.push_back(c);
+            else if (isprint(static_cast<unsigned char>(c)))
+                str.push_back(c);
+            else
+            {
+                char buf[5];
+                snprintf(buf, sizeof(buf), "\\%03o", static_cast<unsigned char>(c));
+                str.append(buf);
+            }
+        }
+        return str.push_back('\"'), str;
+    }
+    /// Find a seed and a mask, with which the hashes of the keys are distinct
+    static pair<uint32_t, uint32_t> perfectHash(const map<string, Schema> &keys)
+    {
+        for (uint32_t size = bit_ceil(keys.size());; size *= 2)
+            for (uint32_t seed = 0; seed < 256; seed++)
+            {
+                vector<bool> used(size);
+                bool ok = true;
+                for (const auto &[name, key] : keys)
+                {
+                    uint32_t i = bin::hashName(name, seed) & (size - 1);
+                    if (used[i])
+                    {
+                        ok = false;
+                        break;
+                    }
+                    used[i] = true;
+                }
+                if (ok)
+                    return {seed, size - 1};
+            }
+    }
+    /// Get the C++ type of a schema, generating a struct named `name` for a Compound with keys
+    string typeOf(const Schema &schema, const string &name)
+    {
+        switch (schema.type)
+        { // clang-format off
+        case TagType::End: return "nbt::Tag";
+        case TagType::Byte: return "std::int8_t";
+        case TagType::Short: return "short";
+        case TagType::Int: return "int";
+        case TagType::Long: return "long long";
+        case TagType::Float: return "float";
+        case TagType::Double: return "double";
+        case TagType::ByteArray: return "std::vector<std::int8_t>";
+        case TagType::String: return "std::string";
+        case TagType::IntArray: return "std::vector<int>";
+        case TagType::LongArray: return "std::vector<long long>";
+        // clang-format on
+        case TagType::Compound:
+            return schema.keys.empty() ? "nbt::Compound" : generateStruct(schema, name);
+        case TagType::List:
+            // vectors of bytes, ints and longs are arrays, so such Lists are kept as they are
+            if (!schema.element)
+                return "nbt::List";
+            switch (schema.element->type)
+            {
+            case TagType::End:
+            case TagType::Byte:
+            case TagType::Int:
+            case TagType::Long:
+            case TagType::List:
+                return "nbt::List";
+            default:
+                return "std::vector<" + typeOf(*schema.element, name) + ">";
+            }
+        default:
+            throw runtime_error("unsupported tag ID");
+        }
+    }
+    string generateStruct(const Schema &schema, string name)
+    {
+        while (!structs.insert(name).second)
+            name.push_back('_');
+        set<string> members{"extra"};
+        vector<tuple<string_view, string, string>> fields; // name, member, type
+        for (const auto &[key, child] : schema.keys)
+        {
+            string member = identifier(key);
+            while (!members.insert(member).second)
+                member.push_back('_');
+            string type = typeOf(child, name + '_' + member);
+            fields.emplace_back(key, member, child.required ? type : "std::optional<" + type + ">");
+        }
+        out << "struct " << name << "\n{\n";
+        for (const auto &[key, member, type] : fields)
+            out << "    " << type << ' ' << member << ";\n";
+        out << "    /// The tags not in the schema\n    nbt::Compound extra;\n};\n";
+        auto [seed, mask] = perfectHash(schema.keys);
+        string hash = "nbt::bin::hashName(name, " + to_string(seed) + "U) & " + to_string(mask) + "U";
+        out << "template <>\nstruct nbt::fields<" << name << ">\n{\n"
+            << "    static constexpr auto extra = &" << name << "::extra;\n"
+            << "    template <typename Func>\n    static constexpr bool forEach(Func &&func)\n    {\n        return ";
+        for (const auto &[key, member, type] : fields)
+            out << "func(" << literal(key) << ", &" << name << "::" << member << ") ||\n               ";
+        out << "false;\n    }\n"
+            << "    template <std::endian endian>\n    static bool dispatch(std::istream &in, nbt::TagType type, std::string_view name, " << name << " &val)\n    {\n"
+            << "        switch (" << hash << ")\n        {\n";
+        for (const auto &[key, member, type] : fields)
+            out << "        case nbt::bin::hashName(" << literal(key) << ", " << seed << "U) & " << mask << "U:\n"
+                << "            if (name != " << literal(key) << ")\n                return false;\n"
+                << "            nbt::bin::binding<endian>::read(in, type, val." << member << ");\n            return true;\n";
+        out << "        default:\n            return false;\n        }\n    }\n};\n";
+        return name;
+    }
+public:
+    Generator(ostream &out) : out(out) {}
+    void generate(const Schema &schema, const string &name)
+    {
+        if (schema.type != TagType::Compound || schema.keys.empty())
+            throw runtime_error("the root schema must be a Compound with keys");
+        out << "// Generated by nbt::schema::generate\n#pragma once\n#include \"lnbt.hpp\"\n";
+        typeOf(schema, identifier(name));
+    }
+};
+} // namespace detail
+/// Generate a header containing a struct for each Compound with keys in a schema, which can be read and written by `nbt::bin::read<T>` and `nbt::bin::write` directly
+/// The names of the tags are dispatched by perfect hashing at compile time, and the tags not in the schema are kept in the `extra` member of the structs
+inline void generate(ostream &out, const Schema &schema, const string &name)
+{
+    detail::Generator(out).generate(schema, name);
+}
+/// Generate a header containing a struct for each Compound with keys in a schema, which can be read and written by `nbt::bin::read<T>` and `nbt::bin::write` directly
+inline void generate(ostream &&out, const Schema &schema, const string &name)
+{
+    generate(out, schema, name);
+}
+} // namespace nbt::schema
+
+namespace nbt::columnar
+{
+/// The type of the values in a column
+enum class Type : uint8_t
+{
+    Long,
+    Double,
+    String
+};
+/// A column to be extracted from documents
+/// The path is like `Level.Sections[0].Y`, where a trailing `#` (like `Entities#`) gets the size of a string, an array, a List or a Compound
+/// A value is null if the path is not found or its type cannot be converted to the type of the column
+struct Column
+{
+    string name;
+    string path;
+    Type type;
+};
+/// A group of rows stored column by column
+struct RowGroup
+{
+    struct Data
+    {
+        /// The bitmap of non-null values
+        vector<uint64_t> valid;
+        vector<int64_t> longs;
+        vector<double> doubles;
+        /// The offsets of strings in `chars`, starting with 0
+        vector<uint64_t> offsets{0};
+        string chars;
+    };
+    size_t rows = 0;
+    vector<Data> columns;
+    bool isValid(size_t column, size_t row) const
+    {
+        return columns[column].valid[row / 64] >> row % 64 & 1;
+    }
+    /// Remove all rows but keep the memory
+    void clear()
+    {
+        rows = 0;
+        for (auto &data : columns)
+        {
+            data.valid.clear(), data.longs.clear(), data.doubles.clear(), data.chars.clear();
+            data.offsets.assign(1, 0);
+        }
+    }
+};
+/// The destination of the row groups, which is called by one thread at a time
+class Sink
+{
+public:
+    virtual ~Sink() = default;
+    virtual void write(const vector<Column> &columns, const RowGroup &group) = 0;
+    /// Called once after all the row groups are written
+    virtual void finish(const vector<Column> &) {}
+};
+/// Write the rows as CSV, where null values are empty
+class CsvSink : public Sink
+{
+    ostream &out;
+    bool header = false;
+    void writeHeader(const vector<Column> &columns)
+    {
+        for (size_t i = 0; i < columns.size(); i++)
+            out << (i == 0 ? "" : ",") << columns[i].name;
+        out << '\n';
+        header = true;
+    }
+public:
+    CsvSink(ostream &out) : out(out) {}
+    void write(const vector<Column> &columns, const RowGroup &group) override
+    {
+        if (!header)
+            writeHeader(columns);
+        for (size_t row = 0; row < group.rows; row++)
+        {
+            for (size_t i = 0; i < columns.size(); i++)
+            {
+                if (i != 0)
+                    out.put(',');
+                if (!group.isValid(i, row))
+                    continue;
+                const auto &data = group.columns[i];
+                char buf[32];
+                switch (columns[i].type)
+                {
+                case Type::Long:
+                    out.write(buf, to_chars(buf, buf + sizeof(buf), data.longs[row]).ptr - buf);
+                    break;
+                case Type::Double:
+                    out.write(buf, to_chars(buf, buf + sizeof(buf), data.doubles[row]).ptr - buf);
+                    break;
+                case Type::String:
+                    out.put('\"');
+                    for (char c : string_view(data.chars).substr(data.offsets[row], data.offsets[row + 1] - data.offsets[row]))
+                        c == '\"' ? out << "\"\"" : out.put(c);
+                    out.put('\"');
+                    break;
+                }
+            }
+            out.put('\n');
+        }
+    }
+    void finish(const vector<Column> &columns) override
+    {
+        if (!header)
+            writeHeader(columns);
+    }
+};
+/// The magic number at the beginning and the end of a columnar file
+inline constexpr char magic[8] = {'L', 'N', 'B', 'T', 'C', 'O', 'L', '1'};
+/// Write the row groups to a native-endian columnar file, in which all data are 8-byte aligned so that it can be memory-mapped and read by `Table`
+/// Layout: magic, column count (u64), then for each column: type (u64), name size (u64), name (padded); then for each row group: row count (u64), then for each column: bitmap of non-null values, and values (i64 or f64) or offsets (u64, rows + 1) and characters (padded); at last, the offsets of row groups (u64), row group count (u64) and magic
+class FileSink : public Sink
+{
+    ostream &out;
+    uint64_t pos = 0;
+    vector<uint64_t> groups;
+    void write(const void *data, size_t size)
+    {
+        out.write(static_cast<const char *>(data), size);
+        pos += size;
+    }
+    void write(uint64_t val)
+    {
+        write(&val, sizeof(val));
+    }
+    void pad()
+    {
+        static constexpr char zeros[8]{};
+        write(zeros, -pos % 8);
+    }
+    void writeHeader(const vector<Column> &columns)
+    {
+        write(magic, sizeof(magic));
+        write(columns.size());
+        for (const auto &column : columns)
+        {
+            write(static_cast<uint64_t>(column.type));
+            write(column.name.size());
+            write(column.name.data(), column.name.size());
+            pad();
+        }
+    }
+public:
+    FileSink(ostream &out) : out(out)
+    {
+        out.exceptions(ostream::eofbit | ostream::failbit | ostream::badbit);
+    }
+    void write(const vector<Column> &columns, const RowGroup &group) override
+    {
+        if (pos == 0)
+            writeHeader(columns);
+        groups.push_back(pos);
+        write(group.rows);
+        for (size_t i = 0; i < columns.size(); i++)
+        {
+            const auto &data = group.columns[i];
+            write(data.valid.data(), (group.rows + 63) / 64 * sizeof(uint64_t));
+            switch (columns[i].type)
+            {
+            case Type::Long:
+                write(data.longs.data(), group.rows * sizeof(int64_t));
+                break;
+            case Type::Double:
+                write(data.doubles.data(), group.rows * sizeof(double));
+                break;
+            case Type::String:
+                write(data.offsets.data(), (group.rows + 1) * sizeof(uint64_t));
+                write(data.chars.data(), data.chars.size());
+                pad();
+                break;
+            }
+        }
+    }
+    void finish(const vector<Column> &columns) override
+    {
+        if (pos == 0)
+            writeHeader(columns);
+        for (uint64_t offset : groups)
+            write(offset);
+        write(groups.size());
+        write(magic, sizeof(magic));
+        out.flush();
+    }
+};
+/// Read a columnar file written by `FileSink` in memory without copying
+class Table
+{
+    const char *data;
+    size_t size;
+    uint64_t load(size_t offset) const
+    {
+        if (offset > size || size - offset < sizeof(uint64_t))
+            throw runtime_error("invalid columnar file");
+        uint64_t val;
+        memcpy(&val, data + offset, sizeof(val));
+        return val;
+    }
+    /// Advance an offset by a number of bytes, which must stay inside the file
+    size_t advance(size_t offset, size_t n) const
+    {
+        if (offset > size || size - offset < n)
+            throw runtime_error("invalid columnar file");
+        return offset + n;
+    }
+    /// The end of the column headers, where the row groups begin
+    size_t header_end;
+public:
+    vector<Column> columns;
+    /// The offsets of the row groups
+    vector<uint64_t> groups;
+    /// A row group in a table
+    struct Group
+    {
+        const Table *table;
+        size_t rows;
+        /// The offsets of the bitmap and the values of each column
+        vector<pair<size_t, size_t>> columns;
+        bool isValid(size_t column, size_t row) const
+        {
+            return table->load(columns[column].first + row / 64 * 8) >> row % 64 & 1;
+        }
+        span<const int64_t> longs(size_t column) const
+        {
+            return {reinterpret_cast<const int64_t *>(table->data + columns[column].second), rows};
+        }
+        span<const double> doubles(size_t column) const
+        {
+            return {reinterpret_cast<const double *>(table->data + columns[column].second), rows};
+        }
+        string_view getString(size_t column, size_t row) const
+        {
+            const uint64_t *offsets = reinterpret_cast<const uint64_t *>(table->data + columns[column].second);
+            return {table->data + columns[column].second + (rows + 1) * 8 + offsets[row], offsets[row + 1] - offsets[row]};
+        }
+    };
+    Table(const char *data, size_t size) : data(data), size(size)
+    {
+        if (size < 32 || memcmp(data, magic, 8) != 0 || memcmp(data + size - 8, magic, 8) != 0)
+            throw runtime_error("invalid columnar file");
+        size_t pos = 8;
+        if (load(pos) > size / 16)
+            throw runtime_error("invalid columnar file");
+        columns.resize(load(pos)), pos += 8;
+        for (auto &column : columns)
+        {
+            column.type = static_cast<Type>(load(pos));
+            size_t name_size = load(pos + 8);
+            pos = advance(pos, 16);
+            advance(pos, name_size);
+            column.name.assign(data + pos, name_size);
+            pos = advance(pos, (name_size + 7) / 8 * 8);
+        }
+        // the offsets of the row groups lie between the column headers and the footer
+        header_end = pos;
+        if (header_end > size - 16)
+            throw runtime_error("invalid columnar file");
+        size_t count = load(size - 16);
+        if (count > (size - 16 - header_end) / 8)
+            throw runtime_error("invalid columnar file");
+        for (size_t i = 0; i < count; i++)
+            groups.push_back(load(size - 16 - (count - i) * 8));
+    }
+    /// Get a row group, checking that its columns lie inside the file and the offsets of its strings are monotonic
+    Group group(size_t i) const
+    {
+        size_t pos = groups.at(i);
+        if (pos % 8 != 0 || pos < header_end)
+            throw runtime_error("invalid columnar file");
+        Group group{this, load(pos), {}};
+        if (group.rows > size / 8)
+            throw runtime_error("invalid columnar file");
+        pos = advance(pos, 8);
+        for (const auto &column : columns)
+        {
+            size_t valid = pos;
+            pos = advance(pos, (group.rows + 63) / 64 * 8);
+            group.columns.emplace_back(valid, pos);
+            if (column.type == Type::String)
+            {
+                size_t offsets = pos;
+                pos = advance(pos, (group.rows + 1) * 8);
+                uint64_t chars = load(offsets + group.rows * 8);
+                if (chars > size)
+                    throw runtime_error("invalid columnar file");
+                for (size_t row = 0, last = 0; row <= group.rows; row++)
+                {
+                    uint64_t offset = load(offsets + row * 8);
+                    if (offset < last || offset > chars)
+                        throw runtime_error("invalid columnar file");
+                    last = offset;
+                }
+                pos = advance(pos, (chars + 7) / 8 * 8);
+            }
+            else
+                pos = advance(pos, group.rows * 8);
+        }
+        return group;
+    }
+};
+/// Extract columns from documents into row groups, and pass them to a sink
+/// It is thread-safe to add documents through different batches
+class Exporter
+{
+    struct Size
+    {
+    };
+    using Step = variant<string, size_t, Size>;
+    vector<Column> columns;
+    vector<vector<Step>> paths;
+    Sink &sink;
+    size_t group_size;
+    std::mutex mutex;
+    static vector<Step> parse(string_view path)
+    {
+        vector<Step> steps;
+        while (!path.empty())
+        {
+            if (path.front() == '.')
+                path.remove_prefix(1);
+            else if (path.front() == '[')
+            {
+                size_t end = path.find(']');
+                if (end == string_view::npos)
+                    throw runtime_error("unexpected end of path");
+                steps.push_back(str::detail::readNum<size_t>(path.substr(1, end - 1)));
+                path.remove_prefix(end + 1);
+            }
+            else if (path == "#")
+            {
+                steps.push_back(Size());
+                path = {};
+            }
+            else
+            {
+                size_t end = min(path.find_first_of(".["), path.size() - path.ends_with('#'));
+                steps.push_back(string(path.substr(0, end)));
+                path.remove_prefix(end);
+            }
+        }
+        return steps;
+    }
+    /// Follow the steps from a value of type T, and write the result to a column
+    template <typename T>
+    static void extract(const T &val, const Step *step, const Step *end, Type type, RowGroup::Data &data, size_t row)
+    {
+        if (step == end)
+        {
+            if constexpr (integral<T> || floating_point<T>)
+            {
+                if (type == Type::Long)
+                {
+                    // a number that doesn't fit (or NaN) is null rather than converted
+                    if constexpr (floating_point<T>)
+                        if (!(val >= -0x1p63 && val < 0x1p63))
+                            return;
+                    data.longs[row] = static_cast<int64_t>(val);
+                }
+                else if (type == Type::Double)
+                    data.doubles[row] = static_cast<double>(val);
+                else
+                    return;
+            }
+            else if constexpr (same_as<T, string>)
+            {
+                if (type != Type::String)
+                    return;
+                data.chars.append(val);
+                data.offsets[row + 1] = data.chars.size();
+            }
+            else
+                return;
+            data.valid[row / 64] |= uint64_t(1) << row % 64;
+        }
+        else if (holds_alternative<Size>(*step))
+        {
+            if constexpr (same_as<T, string> || same_as<T, List> || same_as<T, Compound> || is_array<T>)
+                extract(static_cast<int64_t>(val.size()), end, end, type, data, row);
+        }
+        else if (const string *name = ::std::get_if<string>(step))
+        {
+            if constexpr (same_as<T, Compound>)
+                if (auto iter = val.find(*name); iter != val.end())
+                    match(iter->second.getType(), [&iter, step, end, type, &data, row]<typename U> { extract(iter->second.template get<U>(), step + 1, end, type, data, row); });
+        }
+        else
+        {
+            size_t i = ::std::get<size_t>(*step);
+            if constexpr (same_as<T, List>)
+                match(val.getType(), [&val, i, step, end, type, &data, row]<typename U> {
+                    if (i < val.size())
+                        extract(val.template get<U>()[i], step + 1, end, type, data, row);
+                });
+            else if constexpr (is_array<T>)
+                if (i < val.size())
+                    extract(val[i], step + 1, end, type, data, row);
+        }
+    }
+public:
+    /// A builder of row groups for a thread, which passes the full row groups to the sink
+    class Batch
+    {
+        Exporter &exporter;
+        RowGroup group;
+    public:
+        Batch(Exporter &exporter) : exporter(exporter)
+        {
+            group.columns.resize(exporter.columns.size());
+        }
+        Batch(const Batch &) = delete;
+        /// Flush the remaining rows, ignoring the errors of the sink, which are reported by calling `flush` before
+        ~Batch()
+        {
+            try
+            {
+                flush();
+            }
+            catch (...)
+            {
+            }
+        }
+        /// Add a document as a row
+        void add(const Tag &tag)
+        {
+            size_t row = group.rows++;
+            for (size_t i = 0; i < group.columns.size(); i++)
+            {
+                auto &data = group.columns[i];
+                data.valid.resize((row + 64) / 64);
+                switch (exporter.columns[i].type)
+                {
+                case Type::Long:
+                    data.longs.push_back(0);
+                    break;
+                case Type::Double:
+                    data.doubles.push_back(0);
+                    break;
+                case Type::String:
+                    data.offsets.push_back(data.chars.size());
+                    break;
+                }
+                const auto &path = exporter.paths[i];
+                match(tag.getType(), [this, &tag, &path, i, &data, row]<typename T> { extract(tag.get<T>(), path.data(), path.data() + path.size(), exporter.columns[i].type, data, row); });
+            }
+            if (group.rows >= exporter.group_size)
+                flush();
+        }
+        /// Pass the rows to the sink
+        void flush()
+        {
+            if (group.rows == 0)
+                return;
+            {
+                lock_guard lock(exporter.mutex);
+                exporter.sink.write(exporter.columns, group);
+            }
+            group.clear();
+        }
+    };
+    Exporter(vector<Column> columns, Sink &sink, size_t group_size = 65536) : columns(move(columns)), sink(sink), group_size(group_size)
+    {
+        for (const auto &column : this->columns)
+            paths.push_back(parse(column.path));
+    }
+    /// Create a batch for a thread
+    Batch batch()
+    {
+        return Batch(*this);
+    }
+    /// Finish the output after all batches are flushed
+    void finish()
+    {
+        lock_guard lock(mutex);
+        sink.finish(columns);
+    }
+};
+} // namespace nbt::columnar
+
+#if __has_include(<sys/mman.h>)
+namespace nbt
+{
+/// A read-only memory mapping of a file
+class MappedFile
+{
+    const char *ptr = nullptr;
+    size_t len = 0;
+public:
+    MappedFile() = default;
+    explicit MappedFile(const filesystem::path &path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            throw system_error(errno, generic_category(), "open() error");
+        struct stat st;
+        if (::fstat(fd, &st) == -1)
+        {
+            int err = errno;
+            ::close(fd);
+            throw system_error(err, generic_category(), "fstat() error");
+        }
+        len = st.st_size;
+        if (len != 0)
+        {
+            void *addr = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED)
+            {
+                int err = errno;
+                ::close(fd);
+                throw system_error(err, generic_category(), "mmap() error");
+            }
+            ptr = static_cast<const char *>(addr);
+        }
+        ::close(fd);
+    }
+    MappedFile(MappedFile &&other) noexcept : ptr(exchange(other.ptr, nullptr)), len(exchange(other.len, 0)) {}
+    MappedFile &operator=(MappedFile &&other) noexcept
+    {
+        swap(ptr, other.ptr);
+        swap(len, other.len);
+        return *this;
+    }
+    ~MappedFile()
+    {
+        if (ptr != nullptr)
+            ::munmap(const_cast<char *>(ptr), len);
+    }
+    const char *data() const noexcept
+    {
+        return ptr;
+    }
+    size_t size() const noexcept
+    {
+        return len;
+    }
+    /// Advise the kernel of the access pattern of a range by `madvise`, such as `MADV_SEQUENTIAL` or `MADV_WILLNEED`, which is only a hint and whose errors are ignored
+    void advise(int advice, size_t offset = 0, size_t size = numeric_limits<size_t>::max()) const noexcept
+    {
+        if (ptr == nullptr || offset >= len)
+            return;
+        size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        size_t begin = offset / page * page;
+        ::madvise(const_cast<char *>(ptr) + begin, min(size, len - offset) + (offset - begin), advice);
+    }
+};
+} // namespace nbt
+#endif
+
+namespace nbt::frozen
+{
+/// The magic number at the beginning of a frozen file
+inline constexpr char magic[8] = {'L', 'N', 'B', 'T', 'F', 'R', 'Z', '1'};
+/// The header of a node, which is followed by its payload
+/// Numbers are stored in an 8-byte slot, strings and arrays are stored as their contents, Lists of numbers are stored as packed numbers and other Lists are stored as the offsets of the elements, and Compounds are stored as the offsets of the names and the values sorted by name, where all offsets are from the beginning of the file and all nodes are 8-byte aligned
+struct Node
+{
+    uint8_t type;
+    uint8_t element;
+    uint16_t reserved;
+    uint32_t size;
+};
+static_assert(sizeof(Node) == 8);
+namespace detail
+{
+/// Serialize a tag tree into the frozen format
+class Freezer
+{
+    string &buf;
+    size_t allocate(size_t size)
+    {
+        size_t pos = buf.size();
+        buf.resize(pos + (size + 7) / 8 * 8);
+        return pos;
+    }
+    void store(size_t pos, const void *data, size_t size)
+    {
+        memcpy(buf.data() + pos, data, size);
+    }
+    size_t node(TagType type, size_t size, size_t payload, TagType element = TagType::End)
+    {
+        if (size > numeric_limits<uint32_t>::max())
+            throw runtime_error("too many elements");
+        size_t pos = allocate(sizeof(Node) + payload);
+        Node node{static_cast<uint8_t>(type), static_cast<uint8_t>(element), 0, static_cast<uint32_t>(size)};
+        store(pos, &node, sizeof(node));
+        return pos;
+    }
+public:
+    Freezer(string &buf) : buf(buf) {}
+    template <typename T>
+    size_t freeze(const T &val)
+    {
+        if constexpr (same_as<T, monostate>)
+            return node(TagType::End, 0, 0);
+        else if constexpr (integral<T> || floating_point<T>)
+        {
+            size_t pos = node(tagTypeOf<T>, 1, 8);
+            store(pos + sizeof(Node), &val, sizeof(val));
+            return pos;
+        }
+        else if constexpr (same_as<T, string> || is_array<T>)
+        {
+            size_t pos = node(tagTypeOf<T>, val.size(), val.size() * sizeof(typename T::value_type));
+            store(pos + sizeof(Node), val.data(), val.size() * sizeof(typename T::value_type));
+            return pos;
+        }
+        else if constexpr (same_as<T, List>)
+            return match(val.getType(), [this, &val]<typename U> {
+                const vector<U> &vec = val.template get<U>();
+                if constexpr (integral<U> || floating_point<U>)
+                {
+                    size_t pos = node(TagType::List, vec.size(), vec.size() * sizeof(U), tagTypeOf<U>);
+                    store(pos + sizeof(Node), vec.data(), vec.size() * sizeof(U));
+                    return pos;
+                }
+                else
+                {
+                    size_t pos = node(TagType::List, vec.size(), vec.size() * sizeof(uint64_t), tagTypeOf<U>);
+                    for (size_t i = 0; i < vec.size(); i++)
+                    {
+                        uint64_t offset = freeze(vec[i]);
+                        store(pos + sizeof(Node) + i * sizeof(uint64_t), &offset, sizeof(offset));
+                    }
+                    return pos;
+                }
+            });
+        else if constexpr (same_as<T, Compound>)
+        {
+            size_t pos = node(TagType::Compound, val.size(), val.size() * 2 * sizeof(uint64_t)), i = 0;
+            for (const auto &[name, tag] : val)
+            {
+                uint64_t offsets[2] = {freeze(name), freeze(tag)};
+                store(pos + sizeof(Node) + i++ * sizeof(offsets), offsets, sizeof(offsets));
+            }
+            return pos;
+        }
+        else if constexpr (same_as<T, Tag>)
+            return match(val.getType(), [this, &val]<typename U> { return freeze(val.template get<U>()); });
+    }
+};
+} // namespace detail
+/// Serialize a tag tree into the frozen format
+inline string freeze(const Tag &tag)
+{
+    string buf(magic, sizeof(magic));
+    uint32_t marker = 0x01020304, root = 16;
+    buf.append(reinterpret_cast<const char *>(&marker), sizeof(marker));
+    buf.append(reinterpret_cast<const char *>(&root), sizeof(root));
+    detail::Freezer(buf).freeze(tag);
+    return buf;
+}
+/// Write a tag tree in the frozen format to an output stream
+inline void write(ostream &out, const Tag &tag)
+{
+    out.exceptions(ostream::eofbit | ostream::failbit | ostream::badbit);
+    string buf = freeze(tag);
+    out.write(buf.data(), buf.size());
+}
+/// Write a tag tree in the frozen format to an output stream
+inline void write(ostream &&out, const Tag &tag)
+{
+    write(out, tag);
+}
+/// A read-only accessor of a tag in the frozen format, which reads the data in place
+class Value
+{
+    const char *base;
+    size_t length;
+    const Node *node;
+    /// Check that a node and its payload lie inside the data before it is dereferenced
+    static const Node *check(const char *base, size_t length, size_t offset)
+    {
+        if (offset < 16 || offset % 8 != 0 || offset > length || length - offset < sizeof(Node))
+            throw runtime_error("invalid frozen node offset");
+        const Node *node = reinterpret_cast<const Node *>(base + offset);
+        size_t payload = match(static_cast<TagType>(node->type), [node]<typename T>() -> size_t {
+            if constexpr (same_as<T, monostate>)
+                return 0;
+            else if constexpr (integral<T> || floating_point<T>)
+                return 8;
+            else if constexpr (same_as<T, string> || is_array<T>)
+                return size_t(node->size) * sizeof(typename T::value_type);
+            else if constexpr (same_as<T, List>)
+                return match(static_cast<TagType>(node->element), [node]<typename U>() -> size_t {
+                    if constexpr (same_as<U, monostate>)
+                        return 0;
+                    else if constexpr (integral<U> || floating_point<U>)
+                        return size_t(node->size) * sizeof(U);
+                    else
+                        return size_t(node->size) * sizeof(uint64_t);
+                });
+            else
+                return size_t(node->size) * 2 * sizeof(uint64_t);
+        });
+        if (length - offset - sizeof(Node) < payload)
+            throw runtime_error("the frozen node exceeds the data");
+        return node;
+    }
+    template <typename T>
+    const T *payload() const
+    {
+        return reinterpret_cast<const T *>(node + 1);
+    }
+    /// Get a child, which is always written after its parent, so a cycle in corrupt data can't recurse forever
+    Value at(uint64_t offset) const
+    {
+        if (offset <= static_cast<uint64_t>(reinterpret_cast<const char *>(node) - base))
+            throw runtime_error("invalid frozen node offset");
+        return Value(base, length, offset);
+    }
+    void expect(TagType type) const
+    {
+        if (getType() != type)
+            throw runtime_error("unexpected tag type");
+    }
+public:
+    /// Access the node at an offset of data of a size, which is checked together with its payload
+    Value(const char *base, size_t length, size_t offset) : base(base), length(length), node(check(base, length, offset)) {}
+    /// Get the type of the tag
+    TagType getType() const noexcept
+    {
+        return static_cast<TagType>(node->type);
+    }
+    /// Get the type of the tags in a List
+    TagType getElementType() const noexcept
+    {
+        return static_cast<TagType>(node->element);
+    }
+    /// Get the size of a string, an array, a List or a Compound
+    size_t size() const noexcept
+    {
+        return node->size;
+    }
+    /// Get the number
+    template <typename T>
+        requires integral<T> || floating_point<T>
+    T get() const
+    {
+        expect(tagTypeOf<T>);
+        return *payload<T>();
+    }
+    /// Get the string
+    string_view getString() const
+    {
+        expect(TagType::String);
+        return {payload<char>(), node->size};
+    }
+    /// Get an array or a List of numbers
+    template <typename T>
+        requires integral<T> || floating_point<T>
+    span<const T> getArray() const
+    {
+        bool ok = getType() == TagType::List && getElementType() == tagTypeOf<T>;
+        if constexpr (is_array<vector<T>>)
+            ok = ok || getType() == tagTypeOf<vector<T>>;
+        if (!ok)
+            throw runtime_error("unexpected tag type");
+        return {payload<T>(), node->size};
+    }
+    /// Get the tag in a List (of strings, arrays, Lists or Compounds) by index
+    Value get(size_t i) const
+    {
+        expect(TagType::List);
+        if (i >= node->size)
+            throw out_of_range("index out of range");
+        if (TagType type = getElementType(); type != TagType::String && type != TagType::List && type != TagType::Compound && type != TagType::ByteArray && type != TagType::IntArray && type != TagType::LongArray)
+            throw runtime_error("not a List of nodes, use getArray instead");
+        return at(payload<uint64_t>()[i]);
+    }
+    /// Get the name and the tag in a Compound by index, in the order of names
+    pair<string_view, Value> entry(size_t i) const
+    {
+        expect(TagType::Compound);
+        if (i >= node->size)
+            throw out_of_range("index out of range");
+        const uint64_t *offsets = payload<uint64_t>() + 2 * i;
+        return {at(offsets[0]).getString(), at(offsets[1])};
+    }
+    /// Get the tag in a Compound by name with binary search
+    optional<Value> get_if(string_view name) const
+    {
+        if (getType() != TagType::Compound)
+            return nullopt;
+        size_t first = 0, last = node->size;
+        while (first < last)
+        {
+            size_t mid = first + (last - first) / 2;
+            auto [key, value] = entry(mid);
+            if (int cmp = key.compare(name); cmp == 0)
+                return value;
+            else if (cmp < 0)
+                first = mid + 1;
+            else
+                last = mid;
+        }
+        return nullopt;
+    }
+    /// Get the tag in a Compound by name with binary search
+    Value get(string_view name) const
+    {
+        expect(TagType::Compound);
+        if (optional<Value> value = get_if(name))
+            return *value;
+        throw out_of_range("tag not found");
+    }
+    /// Convert to a tag tree
+    Tag thaw() const
+    {
+        return match(getType(), [this]<typename T>() -> Tag {
+            if constexpr (same_as<T, monostate>)
+                return monostate();
+            else if constexpr (integral<T> || floating_point<T>)
+                return this->template get<T>();
+            else if constexpr (same_as<T, string>)
+                return string(getString());
+            else if constexpr (is_array<T>)
+            {
+                auto span = getArray<typename T::value_type>();
+                return T(span.begin(), span.end());
+            }
+            else if constexpr (same_as<T, List>)
+                return match(getElementType(), [this]<typename U> {
+                    if constexpr (integral<U> || floating_point<U>)
+                    {
+                        auto span = getArray<U>();
+                        return List(vector<U>(span.begin(), span.end()));
+                    }
+                    else if constexpr (same_as<U, monostate>)
+                        return List(vector<monostate>(node->size));
+                    else
+                    {
+                        vector<U> vec;
+                        vec.reserve(node->size);
+                        for (size_t i = 0; i < node->size; i++)
+                            vec.push_back(::std::move(get(i).thaw().template get<U>()));
+                        return List(::std::move(vec));
+                    }
+                });
+            else
+            {
+                Compound compound;
+                for (size_t i = 0; i < node->size; i++)
+                {
+                    auto [name, value] = entry(i);
+                    compound.emplace_hint(compound.end(), name, value.thaw());
+                }
+                return compound;
+            }
+        });
+    }
+};
+/// Get the root tag of data in the frozen format, which must be 8-byte aligned
+inline Value root(const char *data, size_t size)
+{
+    uint32_t marker;
+    if (size < 24 || memcmp(data, magic, sizeof(magic)) != 0)
+        throw runtime_error("not a frozen file");
+    memcpy(&marker, data + 8, sizeof(marker));
+    if (marker != 0x01020304)
+        throw runtime_error("the frozen file is of another endian");
+    if (reinterpret_cast<uintptr_t>(data) % 8 != 0)
+        throw runtime_error("the frozen data is not 8-byte aligned");
+    uint32_t offset;
+    memcpy(&offset, data + 12, sizeof(offset));
+    return Value(data, size, offset);
+}
+#if __has_include(<sys/mman.h>)
+/// A memory-mapped frozen file
+class Snapshot
+{
+    MappedFile file;
+public:
+    explicit Snapshot(const filesystem::path &path) : file(path) {}
+    /// Get the root tag
+    Value root() const
+    {
+        return frozen::root(file.data(), file.size());
+    }
+};
+#endif
+} // namespace nbt::frozen
+
 #endif // _LNBT_HPP
\ No newline at end of file